@@ -1,73 +1,168 @@
 #include "SwRast.h"
 
-namespace swr {
+namespace swr::inline SWR_ISA_NS {
+
+static const int32_t VertexStride = sizeof(ShadedVertexPacket) / sizeof(float);
+
+// Per-lane mapping from the output vertices of Sutherland-Hodgman clipping against one plane to the input vertices.
+// Output `j` is either the intersection with the edge entering the inside of the plane (at `SlotEnter`), the one with
+// the edge leaving it (at `SlotExit`), or input `j + (j > SlotEnter ? Shift : 0)`. The order is the same as what
+// the sequential algorithm would produce for each lane.
+struct PlaneClipMap {
+    VInt SlotEnter, SlotExit, Shift;
+    VInt EnterA, EnterB, ExitA, ExitB;  // Edge endpoints
+    VFloat EnterT, ExitT;
+
+    PlaneClipMap(const VFloat* dist, VInt& count, uint32_t maxCount, VMask mask) {
+        VInt insideBits = 0;
+
+        for (uint32_t i = 0; i < maxCount; i++) {
+            insideBits = insideBits | simd::csel(dist[i] >= 0.0f, VInt(1 << i), 0);
+        }
+        VInt fullBits = (VInt(1) << count) - 1;
+        insideBits = simd::csel(mask, insideBits & fullBits, fullBits);
+
+        // Inside flags of the next vertex of each edge, wrapping around at `count`
+        VInt nextBits = (insideBits >> 1) | ((insideBits & 1) << (count - 1));
+        VInt enterBits = nextBits ^ (nextBits & insideBits);
+        VInt exitBits = insideBits ^ (nextBits & insideBits);
+        VInt enter = 0, exit = 0;
+
+        for (uint32_t i = 0; i < maxCount; i++) {
+            enter = simd::csel((enterBits & (1 << i)) != 0, VInt((int32_t)i), enter);
+            exit = simd::csel((exitBits & (1 << i)) != 0, VInt((int32_t)i), exit);
+        }
+        EnterA = enter, EnterB = simd::csel(enter + 1 == count, 0, enter + 1);
+        ExitA = exit, ExitB = simd::csel(exit + 1 == count, 0, exit + 1);
+
+        // If the first vertex is inside, the output starts with the inputs up to the exit edge, otherwise with the enter edge.
+        VMask firstInside = (insideBits & 1) != 0;
+        VMask allInside = insideBits == fullBits;
+
+        SlotExit = simd::csel(firstInside, exit + 1, exit - enter + 1);
+        SlotEnter = simd::csel(firstInside, exit + 2, 0);
+        Shift = simd::csel(firstInside, enter - exit - 2, enter);
+
+        SlotExit = simd::csel(allInside, (int32_t)Clipper::MaxVertices, SlotExit);
+        SlotEnter = simd::csel(allInside, (int32_t)Clipper::MaxVertices, SlotEnter);
+        Shift = simd::csel(allInside, 0, Shift);
+
+        VInt clippedCount = simd::csel(firstInside, count - (enter - exit) + 2, exit - enter + 2);
+        count = simd::csel(allInside, count, simd::csel(insideBits == 0, 0, clippedCount));
+
+        VInt laneOffset = VInt::ramp() * (int32_t)sizeof(float);
+        const auto GetT = [&](VInt a, VInt b) {
+            VFloat da = VFloat::gather(dist, a * (int32_t)sizeof(VFloat) + laneOffset);
+            VFloat db = VFloat::gather(dist, b * (int32_t)sizeof(VFloat) + laneOffset);
+            return da / (da - db);
+        };
+        EnterT = GetT(EnterA, EnterB);
+        ExitT = GetT(ExitA, ExitB);
+    }
+};
 
 // dot(vtx.XYZ, plane.Norm) + vtx.W * dist
-static float GetIntersectDist(const Clipper::Vertex& vtx, Clipper::Plane plane, float dist) {
-    float a = vtx.Attribs[(uint32_t)plane / 2];
+static VFloat GetIntersectDist(const ShadedVertexPacket& vtx, Clipper::Plane plane, float dist) {
+    VFloat a = (&vtx.Position.x)[(uint32_t)plane / 2];
     if ((uint32_t)plane % 2) a = -a;
 
-    return a + vtx.Attribs[3] * dist;
+    return a + vtx.Position.w * dist;
 }
 
 // https://www.cubic.org/docs/3dclip.htm
-void Clipper::ClipAgainstPlane(Plane plane, uint32_t numAttribs) {
-    if (Count < 3) return;  // triangle has been fully clipped away
-
+template<bool FromTriangle>
+void Clipper::ClipAgainstPlane(const ShadedVertexPacket* src, ShadedVertexPacket* dest, Plane plane, VMask mask, uint32_t numAttribs) {
     float planeDist = plane < Plane::Near ? GuardBandPlaneDistXY[(uint32_t)plane / 2] : 1.0f;
-    uint8_t tempIndices[24];
-    uint32_t j = 0;
+    VFloat dist[MaxVertices];
 
-    for (uint32_t i = 0; i < Count; i++) {
-        Vertex& va = Vertices[Indices[i]];
-        Vertex& vb = Vertices[Indices[(i + 1) % Count]];
+    for (uint32_t i = 0; i < MaxCount; i++) {
+        dist[i] = GetIntersectDist(src[i], plane, planeDist);
+    }
+    PlaneClipMap map(dist, Count, MaxCount, mask);
+    uint32_t maxCount = (uint32_t)simd::reduce_max(simd::conv2f(Count));
+    assert(maxCount <= MaxVertices);
 
-        float da = GetIntersectDist(va, plane, planeDist);
-        float db = GetIntersectDist(vb, plane, planeDist);
+    VInt laneOffset = VInt::ramp() * (int32_t)sizeof(float);
 
-        if (da >= 0) {
-            tempIndices[j++] = Indices[i];
-        }
+    for (uint32_t j = 0; j < maxCount; j++) {
+        VMask isEnter = map.SlotEnter == (int32_t)j;
+        VMask isExit = map.SlotExit == (int32_t)j;
+        VMask isIntersect = isEnter | isExit;
 
-        // Calculate intersection if distance signs differ
-        if ((da >= 0) != (db >= 0)) {
-            tempIndices[j++] = FreeVtx;
-            Vertex& dest = Vertices[FreeVtx++];
+        VInt srcA = (int32_t)j + simd::csel(map.SlotEnter < (int32_t)j, map.Shift, 0);
+        srcA = simd::csel(isEnter, map.EnterA, simd::csel(isExit, map.ExitA, srcA));
+        VInt srcB = simd::csel(isEnter, map.EnterB, map.ExitB);
+        VFloat t = simd::csel(isEnter, map.EnterT, map.ExitT);
 
-            float t = da / (da - db);
+        // Lanes with fewer than `j + 1` output vertices compute garbage sources, which must still stay within
+        // the polygon buffers since gathers are not masked. Their output is ignored past `Count`.
+        srcA = simd::max(simd::min(srcA, (int32_t)MaxVertices - 1), 0);
+        srcB = simd::max(simd::min(srcB, (int32_t)MaxVertices - 1), 0);
 
-            assert(numAttribs <= sizeof(va.Attribs) / 4);
+        // The input triangle only has 3 vertices, which are cheaper to select than to gather.
+        VMask srcA0 = srcA == 0, srcA1 = srcA == 1, srcB0 = srcB == 0, srcB1 = srcB == 1;
+        VInt offsetA = srcA * (VertexStride * (int32_t)sizeof(float)) + laneOffset;
+        VInt offsetB = srcB * (VertexStride * (int32_t)sizeof(float)) + laneOffset;
 
-            for (uint32_t ai = 0; ai < numAttribs; ai += VFloat::Length) {
-                VFloat a = VFloat::load(&va.Attribs[ai]);
-                VFloat b = VFloat::load(&vb.Attribs[ai]);
-                VFloat r = simd::lerp(a, b, t);
-                r.store(&dest.Attribs[ai]);
+        for (uint32_t ai = 0; ai < numAttribs; ai++) {
+            const VFloat* srcAttrib = &src->Position.x + ai;
+            VFloat a, b;
+
+            if constexpr (FromTriangle) {
+                const VFloat* srcAttrib1 = srcAttrib + VertexStride / VFloat::Length;
+                const VFloat* srcAttrib2 = srcAttrib1 + VertexStride / VFloat::Length;
+
+                a = simd::csel(srcA0, *srcAttrib, simd::csel(srcA1, *srcAttrib1, *srcAttrib2));
+                b = simd::csel(srcB0, *srcAttrib, simd::csel(srcB1, *srcAttrib1, *srcAttrib2));
+            } else {
+                a = VFloat::gather(srcAttrib, offsetA);
+                b = VFloat::gather(srcAttrib, offsetB);
             }
+            (&dest[j].Position.x)[ai] = simd::csel(isIntersect, simd::lerp(a, b, t), a);
         }
     }
-    std::memcpy(Indices, tempIndices, 24); //small constant size copy likely to perform better than var
-    Count = j;
-    assert(Count < 24);
+    MaxCount = maxCount;
+}
+
+void Clipper::ClipTriangles(const TrianglePacket& tri, const ClipCodes& cc, uint32_t numAttribs) {
+    assert(numAttribs <= 4 + ShadedVertexPacket::MaxAttribs);
+
+    Count = simd::csel(cc.NonTrivialMask, VInt(3), VInt(0));
+    MaxCount = 3;
+    _polygon = tri.Vertices;
+
+    // Planes are visited in the same order for all lanes. The first one clips the source triangle directly,
+    // which is the only step needed in the common case where triangles only cross the near plane.
+    for (uint32_t i = 0; i < 6 && MaxCount >= 3; i++) {
+        VMask mask = cc.NonTrivialMask & ((cc.OutCodes & (1 << i)) != 0);
+        if (!mask) continue;
+
+        ShadedVertexPacket* dest = _buffers[_polygon == _buffers[0]];
+
+        if (_polygon == tri.Vertices) {
+            ClipAgainstPlane<true>(_polygon, dest, (Plane)i, mask, numAttribs);
+        } else {
+            ClipAgainstPlane<false>(_polygon, dest, (Plane)i, mask, numAttribs);
+        }
+        _polygon = dest;
+    }
 }
 
 Clipper::ClipCodes Clipper::ComputeClipCodes(const TrianglePacket& tri) {
-    auto partialOut = _mm_set1_epi8(0);    // non-zero if at least one vertex is out
-    auto combinedOut = _mm_set1_epi8(~0);  // non-zero if all vertices are out
+    VInt partialOut = 0;    // non-zero if at least one vertex is out
+    VInt combinedOut = ~0;  // non-zero if all vertices are out
 
     for (uint32_t i = 0; i < 3; i++) {
         const VFloat4& pos = tri.Vertices[i].Position;
-        auto outcode = _mm_set1_epi8(0);
+        VInt outcode = 0;
 
         const auto MaskN = [&](VFloat x, Clipper::Plane p) {
             VMask m = x < -pos.w;
-            auto c = _mm_maskz_mov_epi8(m, _mm_set1_epi8(1 << (int)p));
-            outcode = _mm_or_si128(outcode, c);
+            outcode = outcode | simd::csel(m, VInt(1 << (int)p), 0);
         };
         const auto MaskP = [&](VFloat x, Clipper::Plane p) {
             VMask m = x > pos.w;
-            auto c = _mm_maskz_mov_epi8(m, _mm_set1_epi8(1 << (int)p));
-            outcode = _mm_or_si128(outcode, c);
+            outcode = outcode | simd::csel(m, VInt(1 << (int)p), 0);
         };
         MaskN(pos.x, Clipper::Plane::Left);
         MaskP(pos.x, Clipper::Plane::Right);
@@ -76,44 +171,32 @@ Clipper::ClipCodes Clipper::ComputeClipCodes(const TrianglePacket& tri) {
         MaskN(pos.z, Clipper::Plane::Near);
         MaskP(pos.z, Clipper::Plane::Far);
 
-        partialOut = _mm_or_si128(partialOut, outcode);
-        combinedOut = _mm_and_si128(combinedOut, outcode);
+        partialOut = partialOut | outcode;
+        combinedOut = combinedOut & outcode;
     }
 
-    VMask acceptMask = _mm_cmpeq_epi8_mask(partialOut, _mm_set1_epi8(0));
-    VMask rejectMask = _mm_cmpneq_epi8_mask(combinedOut, _mm_set1_epi8(0));
+    VMask acceptMask = partialOut == 0;
+    VMask rejectMask = combinedOut != 0;
 
     ClipCodes codes = {
         .AcceptMask = (VMask)(acceptMask & ~rejectMask),
         .NonTrivialMask = (VMask)(~acceptMask & ~rejectMask),
+        .OutCodes = partialOut,
     };
-    _mm_storeu_si128((__m128i*)codes.OutCodes, partialOut);
     return codes;
 }
 
-void Clipper::LoadTriangle(TrianglePacket& srcTri, uint32_t srcTriIdx, uint32_t numAttribs) {
-    for (uint32_t vi = 0; vi < 3; vi++) {
-        VFloat* src = &srcTri.Vertices[vi].Position.x;
-        float* dest = Vertices[vi].Attribs;
-
-        for (uint32_t ai = 0; ai < numAttribs; ai++) {
-            dest[ai] = src[ai][srcTriIdx];
-        }
-        Indices[vi] = vi;
-    }
-    FreeVtx = Count = 3;
-}
-void Clipper::StoreTriangle(TrianglePacket& destTri, uint32_t destTriIdx, uint32_t srcTriFanIdx, uint32_t numAttribs) {
-    uint32_t srcIdx[3]{ 0, srcTriFanIdx + 1, srcTriFanIdx + 2 };
+void Clipper::StoreTriangles(TrianglePacket& destTri, uint32_t fanIdx, VInt srcLanes, VMask mask, uint32_t numAttribs) {
+    const ShadedVertexPacket* srcVertices[3] = { &_polygon[0], &_polygon[fanIdx + 1], &_polygon[fanIdx + 2] };
 
     for (uint32_t vi = 0; vi < 3; vi++) {
         VFloat* dest = &destTri.Vertices[vi].Position.x;
-        float* src = Vertices[Indices[srcIdx[vi]]].Attribs;
+        const VFloat* src = &srcVertices[vi]->Position.x;
 
         for (uint32_t ai = 0; ai < numAttribs; ai++) {
-            dest[ai][destTriIdx] = src[ai];
+            dest[ai] = simd::csel(mask, simd::permute(src[ai], srcLanes), dest[ai]);
         }
     }
 }
 
-}; // namespace swr
\ No newline at end of file
+}; // namespace swr
@@ -0,0 +1,104 @@
+// ISA independent parts of the renderer. This is compiled only once, even in dispatch builds,
+// so nothing in here may depend on SIMD.h or the SWR_ISA_NS namespace.
+#include <chrono>
+#include <cstring>
+
+#include "CpuDispatch.h"
+#include "ProfilerStats.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#else
+    #include <cpuid.h>
+#endif
+
+namespace swr {
+
+ProfilerStats g_Stats = {};
+
+uint64_t ProfilerStats::CurrentTime() {
+    auto time = std::chrono::high_resolution_clock::now();
+    return (uint64_t)time.time_since_epoch().count();
+}
+
+static void ReadCpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+static uint64_t ReadXCR0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return lo | (uint64_t)hi << 32;
+#endif
+}
+
+IsaLevel DetectIsaLevel() {
+    uint32_t leaf1[4], leaf7[4], leafExt1[4];
+    ReadCpuid(0, 0, leaf1);
+    uint32_t maxLeaf = leaf1[0];
+
+    ReadCpuid(0x80000000, 0, leafExt1);
+    uint32_t maxExtLeaf = leafExt1[0];
+
+    if (maxLeaf < 7 || maxExtLeaf < 0x80000001) return IsaLevel::Baseline;
+
+    ReadCpuid(1, 0, leaf1);
+    ReadCpuid(7, 0, leaf7);
+    ReadCpuid(0x80000001, 0, leafExt1);
+
+    const auto HasBits = [](uint32_t reg, uint32_t bits) { return (reg & bits) == bits; };
+
+    // OS must save YMM state (and ZMM/opmask for AVX-512), otherwise the instructions will fault.
+    if (!HasBits(leaf1[2], 1u << 27)) return IsaLevel::Baseline;  // OSXSAVE
+    uint64_t xcr0 = ReadXCR0();
+
+    // ECX: FMA, MOVBE, F16C, AVX. EBX: BMI1, AVX2, BMI2. LZCNT is in extended ECX.
+    bool v3 = HasBits(leaf1[2], 1u << 12 | 1u << 22 | 1u << 28 | 1u << 29) &&  //
+              HasBits(leaf7[1], 1u << 3 | 1u << 5 | 1u << 8) &&               //
+              HasBits(leafExt1[2], 1u << 5) && (xcr0 & 0x06) == 0x06;
+    if (!v3) return IsaLevel::Baseline;
+
+    // EBX: AVX512F, AVX512DQ, AVX512CD, AVX512BW, AVX512VL
+    bool v4 = HasBits(leaf7[1], 1u << 16 | 1u << 17 | 1u << 28 | 1u << 30 | 1u << 31) && (xcr0 & 0xE0) == 0xE0;
+    if (!v4) return IsaLevel::X86_64_V3;
+
+    // ECX: AVX512VBMI, GFNI, VAES
+    bool v4x = HasBits(leaf7[2], 1u << 1 | 1u << 8 | 1u << 9);
+    return v4x ? IsaLevel::X86_64_V4X : IsaLevel::X86_64_V4;
+}
+
+bool ParseIsaLevel(const char* name, IsaLevel& level) {
+    const char* shortNames[] = { "v3", "v4", "v4x" };
+    IsaLevel levels[] = { IsaLevel::X86_64_V3, IsaLevel::X86_64_V4, IsaLevel::X86_64_V4X };
+
+    for (uint32_t i = 0; i < 3; i++) {
+        if (strcmp(name, shortNames[i]) == 0 || strcmp(name, GetIsaName(levels[i])) == 0) {
+            level = levels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetIsaName(IsaLevel level) {
+    switch (level) {
+        case IsaLevel::X86_64_V3: return "x86-64-v3";
+        case IsaLevel::X86_64_V4: return "x86-64-v4";
+        case IsaLevel::X86_64_V4X: return "x86-64-v4+VBMI/GFNI";
+        default: return "baseline";
+    }
+}
+
+};  // namespace swr
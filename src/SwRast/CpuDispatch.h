@@ -0,0 +1,30 @@
+#pragma once
+
+// Runtime ISA dispatch.
+// With SWRAST_SIMD=dispatch, the renderer sources are compiled once per target level, each
+// build going into its own `SWR_ISA_NS` inline namespace so they can be linked into one binary.
+// Entry points then pick a variant at startup using DetectIsaLevel().
+// Other builds use a single `isa_native` namespace, which is transparent to callers.
+#ifndef SWR_ISA_NS
+    #define SWR_ISA_NS isa_native
+#endif
+
+namespace swr {
+
+enum class IsaLevel {
+    Baseline,   // Anything below x86-64-v3, unsupported by dispatch builds
+    X86_64_V3,  // AVX2 + FMA + F16C + BMI1/2 (Haswell, Zen)
+    X86_64_V4,  // AVX-512 F/BW/DQ/VL/CD (Skylake-X, Zen 4)
+    X86_64_V4X, // x86-64-v4 + VBMI + GFNI + VAES (Ice Lake, Zen 4)
+};
+
+// Returns the highest level supported by both the CPU and the OS (via cpuid/xgetbv).
+IsaLevel DetectIsaLevel();
+
+// Parses a level name as printed by GetIsaName() or its short form ("v3", "v4", "v4x").
+// Returns false if `name` is not recognized.
+bool ParseIsaLevel(const char* name, IsaLevel& level);
+
+const char* GetIsaName(IsaLevel level);
+
+};  // namespace swr
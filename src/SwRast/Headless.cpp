@@ -0,0 +1,472 @@
+#include <cstdio>
+#include <string>
+#include <filesystem>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+
+#include "SwRast.h"
+#include "Texture.h"
+
+#include "Scene.h"
+#include "RendererShaders.h"
+#include "ThreadPool.h"
+#include "Memory.h"
+
+namespace headless::inline SWR_ISA_NS {
+
+// Offline renderer for machines without a display or GPU.
+// Renders a fixed camera view for a number of frames and writes them to disk.
+struct HeadlessOptions {
+    std::string ScenePath = "assets/models/Sponza/Sponza.gltf";
+    std::string SkyboxPath = "assets/skyboxes/sunflowers_puresky_4k.hdr";
+    std::string OutputPath = "frame_{}.png";  // "{}" is replaced with the frame number
+
+    uint32_t Width = 1280, Height = 720;
+    uint32_t NumFrames = 1;
+
+    glm::vec3 CamPosition = { -7, 5.5f, 0 };
+    glm::vec2 CamEuler = { -0.88f, -0.32f };  // yaw, pitch
+    float FieldOfView = 90.0f;
+
+    bool EnableShadows = false;
+    float ShadowRange = 15.0f;
+    uint32_t ShadowRes = 1024;
+
+    bool EnableSSAO = false;
+    bool EnableTAA = true;
+    bool HzbOcclusion = true;
+    bool VisibilityBuffer = false;
+    bool FusedCompose = true;  // Only without SSAO
+    bool BlurSkybox = false;
+    bool SaveFrames = true;
+
+    float Exposure = 1.0f;
+    float IntensityIBL = 0.3f;
+
+    uint32_t NumThreads = 0;  // 0 = all available cores
+    uint32_t BatchSize = swr::TriangleBatch::DefaultCapacity;
+    bool PinThreads = false;
+
+    swr::MemoryConfig Memory;
+    bool PrintMemoryStats = false;
+};
+
+class HeadlessRenderer {
+    HeadlessOptions _opts;
+
+    std::shared_ptr<swr::Framebuffer> _fb;
+    std::unique_ptr<swr::Rasterizer> _rast;
+    std::shared_ptr<scene::Model> _scene, _shadowScene;
+    std::unique_ptr<renderer::DefaultShader> _shader;
+
+    scene::DepthPyramid _depthPyramid;
+    renderer::SSAO _ssao;
+    renderer::VisibilityBuffer _visBuffer;
+
+    glm::vec3 _lightPos = glm::vec3(0.589494, 0.684509, 0.428906) * 18.0f;
+    glm::mat4 _shadowProjMat;
+
+    std::shared_ptr<swr::Framebuffer> _shadowFb;
+    std::unique_ptr<swr::Rasterizer> _shadowRast;
+
+public:
+    HeadlessRenderer(const HeadlessOptions& opts) : _opts(opts) {
+        _shader = std::make_unique<renderer::DefaultShader>();
+        _shader->Exposure = opts.Exposure;
+        _shader->IntensityIBL = opts.IntensityIBL;
+        _shader->EnableTAA = opts.EnableTAA;
+        _shader->BlurSkybox = opts.BlurSkybox;
+
+        std::filesystem::path scenePath = opts.ScenePath;
+        _scene = std::make_shared<scene::Model>(scenePath.string());
+
+        if (scenePath.filename().compare("Sponza.gltf") == 0) {
+            _shadowScene = std::make_shared<scene::Model>(scenePath.replace_filename("Sponza_LowPoly.gltf").string());
+        } else {
+            _shadowScene = _scene;
+        }
+
+        if (!opts.SkyboxPath.empty()) {
+            _shader->SetSkybox(swr::texutil::LoadCubemapFromPanoramaHDR(opts.SkyboxPath));
+        }
+
+        _fb = std::make_shared<swr::Framebuffer>(opts.Width, opts.Height, renderer::DefaultShader::FbAttachments);
+        _rast = std::make_unique<swr::Rasterizer>(_fb, opts.BatchSize);
+    }
+
+    void Render() {
+        STAT_TIME_BEGIN(Frame);
+
+        if (_opts.EnableShadows && _shadowScene != nullptr) {
+            STAT_TIME_BEGIN(Shadow);
+            RenderShadow();
+            STAT_TIME_END(Shadow);
+        }
+
+        // Same conventions as `Camera::GetViewMatrix()` in first person mode.
+        glm::mat4 viewMat = glm::translate(glm::eulerAngleXY(-_opts.CamEuler.y, -_opts.CamEuler.x), -_opts.CamPosition);
+        glm::mat4 projMat = glm::perspective(glm::radians(_opts.FieldOfView), (float)_opts.Width / (float)_opts.Height, 0.01f, 1000.0f);
+
+        _shader->UpdateJitter(projMat, *_fb);  // add jitter to `projMat`
+
+        glm::mat4 projViewMat = projMat * viewMat;
+
+        _shader->ShadowBuffer = _opts.EnableShadows ? _shadowFb.get() : nullptr;
+        _shader->ShadowProjMat = _shadowProjMat;
+        _shader->ViewMat = viewMat;
+        _shader->LightPos = _lightPos;
+        _shader->ViewPos = _opts.CamPosition;
+
+        _fb->ClearDepth(1.0f);
+
+        _scene->Traverse([&](const scene::Node& node, const glm::mat4& modelMat) {
+            for (uint32_t meshId : node.Meshes) {
+                scene::Mesh& mesh = _scene->Meshes[meshId];
+
+                if (_opts.HzbOcclusion && !_depthPyramid.IsVisible(mesh, modelMat)) continue;
+
+                swr::VertexReader data(
+                    (uint8_t*)&_scene->VertexBuffer[mesh.VertexOffset],
+                    (uint8_t*)&_scene->IndexBuffer[mesh.IndexOffset],
+                    mesh.IndexCount, swr::VertexReader::U16, mesh.VertexCount);
+
+                renderer::SurfaceShader shader = {
+                    .ProjMat = projViewMat * modelMat,
+                    .ModelMat = modelMat,
+                    .MaterialTex = mesh.Material->Texture,
+                };
+                if (_opts.VisibilityBuffer) {
+                    _visBuffer.Submit(*_rast, data, shader, mesh.Material->AlphaTested);
+                } else {
+                    _rast->Submit(data, shader);
+                }
+            }
+            return true;
+        });
+        _shader->ProjMat = projViewMat;
+
+        // SSAO needs the whole depth buffer, so it can't be fused with rasterization.
+        bool fusedCompose = _opts.FusedCompose && !_opts.EnableSSAO;
+
+        if (fusedCompose) {
+            // Resolve and compose each bin right after it is rasterized, times are included in Rasterize.
+            _rast->Flush([&](uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+                if (_opts.VisibilityBuffer) {
+                    _visBuffer.ResolveRegion(*_fb, x, y, width, height);
+                }
+                _shader->ComposeRegion(*_fb, x, y, width, height);
+            });
+            if (_opts.VisibilityBuffer) {
+                _visBuffer.EndResolve();
+            }
+            _shader->EndCompose(*_fb);
+        } else {
+            _rast->Flush();
+        }
+
+        if (_opts.VisibilityBuffer && !fusedCompose) {
+            STAT_TIME_BEGIN(Rasterize);
+            _visBuffer.Resolve(*_fb);
+            STAT_TIME_END(Rasterize);
+        }
+
+        STAT_TIME_BEGIN(Compose);
+
+        if (_opts.HzbOcclusion) {
+            _depthPyramid.Update(*_fb, projViewMat);
+        }
+        if (_opts.EnableSSAO) {
+            _ssao.Generate(*_fb, _depthPyramid, projViewMat);
+        }
+        if (!fusedCompose) {
+            _shader->Compose(*_fb, _opts.EnableSSAO, *_fb);
+        }
+
+        STAT_TIME_END(Compose);
+        STAT_TIME_END(Frame);
+    }
+
+    void RenderShadow() {
+        if (_shadowFb == nullptr) {
+            _shadowFb = std::make_shared<swr::Framebuffer>(_opts.ShadowRes, _opts.ShadowRes);
+            _shadowRast = std::make_unique<swr::Rasterizer>(_shadowFb, _opts.BatchSize);
+        }
+        float range = _opts.ShadowRange;
+
+        _shadowProjMat = glm::ortho(-range, +range, -range, +range, 0.05f, 40.0f) *
+                         glm::lookAt(_lightPos, glm::vec3(0.0f), glm::vec3(0, 1, 0));
+
+        _shadowFb->ClearDepth(1.0f);
+
+        _shadowScene->Traverse([&](const scene::Node& node, const glm::mat4& modelMat) {
+            for (uint32_t meshId : node.Meshes) {
+                scene::Mesh& mesh = _shadowScene->Meshes[meshId];
+
+                swr::VertexReader data(
+                    (uint8_t*)&_shadowScene->VertexBuffer[mesh.VertexOffset],
+                    (uint8_t*)&_shadowScene->IndexBuffer[mesh.IndexOffset],
+                    mesh.IndexCount, swr::VertexReader::U16, mesh.VertexCount);
+
+                _shadowRast->Submit(data, renderer::DepthOnlyShader{ .ProjMat = _shadowProjMat * modelMat });
+            }
+            return true;
+        });
+        _shadowRast->Flush();
+    }
+
+    void SaveFrame(uint32_t frameNo) {
+        std::string path = _opts.OutputPath;
+        size_t pos = path.find("{}");
+
+        if (pos != std::string::npos) {
+            path.replace(pos, 2, std::to_string(frameNo));
+        }
+        _fb->SaveImage(path);
+    }
+};
+
+static void PrintUsage() {
+    std::fputs(
+        "Usage: SwRastHeadless [options]\n"
+        "  --scene <path>           Scene file to load\n"
+        "  --skybox <path|none>     Equirectangular HDR environment map\n"
+        "  --res <W>x<H>            Framebuffer resolution, up to 16384x16384 (default 1280x720)\n"
+        "  --cam <x,y,z,yaw,pitch>  Camera position and rotation (radians)\n"
+        "  --fov <deg>              Vertical field of view (default 90)\n"
+        "  --frames <N>             Number of frames to render (default 1)\n"
+        "  --out <path>             Output image path, \"{}\" is replaced with frame number (default frame_{}.png)\n"
+        "  --no-save                Don't write frames to disk, only measure throughput\n"
+        "  --shadows                Enable shadow mapping\n"
+        "  --shadow-res <N>         Shadow map resolution, 128 or more (default 1024)\n"
+        "  --ssao                   Enable screen space ambient occlusion\n"
+        "  --no-taa                 Disable temporal anti-aliasing\n"
+        "  --no-hzb                 Disable hierarchical-Z occlusion culling\n"
+        "  --visbuffer              Rasterize triangle IDs only, then shade the G-Buffer once per visible pixel\n"
+        "  --no-fused-compose       Light and resolve TAA in separate full-screen passes rather than per bin\n"
+        "  --blur-skybox            Use the pre-filtered environment map for the skybox\n"
+        "  --exposure <f>           Exposure multiplier (default 1.0)\n"
+        "  --ibl <f>                Image based lighting intensity (default 0.3)\n"
+        "  --threads <N>            Number of rendering threads (default all cores)\n"
+        "  --pin                    Pin each rendering thread to a different core\n"
+        "  --batch-size <N>         Triangles each thread sets up before they are rasterized (default 4096)\n"
+        "  --pages <heap|thp|huge>  Pages for large buffers: heap, transparent huge pages (default), or reserved huge pages\n"
+        "  --numa <policy>          NUMA placement of large buffers: first-touch (default), interleave, or partition (with --pin)\n"
+        "  --mem-stats              Print the size and placement of live buffers after rendering\n",
+        stdout);
+}
+
+// Parses the whole of `value` as a number within [min, max]. Prints an error and returns false otherwise.
+template<typename T>
+static bool ParseNumber(std::string_view option, const char* value, T min, T max, T& result) {
+    bool valid = false;
+
+    // Parsed at a wider type, so that negative or too large values can't wrap around into the range
+    try {
+        size_t end = 0;
+
+        if constexpr (std::is_floating_point_v<T>) {
+            double n = std::stod(value, &end);
+            valid = value[end] == '\0' && n >= min && n <= max;
+            if (valid) result = (T)n;
+        } else {
+            long long n = std::stoll(value, &end);
+            valid = value[end] == '\0' && n >= (long long)min && n <= (long long)max;
+            if (valid) result = (T)n;
+        }
+    } catch (const std::exception&) {
+        valid = false;
+    }
+    if (!valid) {
+        if constexpr (std::is_floating_point_v<T>) {
+            std::fprintf(stderr, "Invalid value '%s' for option '%.*s', expected a number in [%g, %g]\n", value, (int)option.size(),
+                         option.data(), (double)min, (double)max);
+        } else {
+            std::fprintf(stderr, "Invalid value '%s' for option '%.*s', expected an integer in [%lld, %lld]\n", value, (int)option.size(),
+                         option.data(), (long long)min, (long long)max);
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool ParseOptions(int argc, char** args, HeadlessOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = args[i];
+        const char* value = i + 1 < argc ? args[i + 1] : nullptr;
+
+        // Flags without values
+        if (arg == "--no-save") { opts.SaveFrames = false; continue; }
+        if (arg == "--shadows") { opts.EnableShadows = true; continue; }
+        if (arg == "--ssao") { opts.EnableSSAO = true; continue; }
+        if (arg == "--no-taa") { opts.EnableTAA = false; continue; }
+        if (arg == "--no-hzb") { opts.HzbOcclusion = false; continue; }
+        if (arg == "--visbuffer") { opts.VisibilityBuffer = true; continue; }
+        if (arg == "--no-fused-compose") { opts.FusedCompose = false; continue; }
+        if (arg == "--blur-skybox") { opts.BlurSkybox = true; continue; }
+        if (arg == "--pin") { opts.PinThreads = true; continue; }
+        if (arg == "--mem-stats") { opts.PrintMemoryStats = true; continue; }
+        if (arg == "--help" || arg == "-h") return false;
+
+        if (value == nullptr) {
+            std::fprintf(stderr, "Missing value for option '%.*s'\n", (int)arg.size(), arg.data());
+            return false;
+        }
+        i++;
+
+        if (arg == "--scene") {
+            opts.ScenePath = value;
+        } else if (arg == "--skybox") {
+            opts.SkyboxPath = std::string_view(value) == "none" ? "" : value;
+        } else if (arg == "--out") {
+            opts.OutputPath = value;
+        } else if (arg == "--res") {
+            const uint32_t maxSize = swr::TrianglePacket::MaxViewportSize;
+
+            if (sscanf(value, "%ux%u", &opts.Width, &opts.Height) != 2 || opts.Width < 4 || opts.Height < 4 ||
+                opts.Width > maxSize || opts.Height > maxSize) {
+                std::fprintf(stderr, "Invalid resolution '%s'\n", value);
+                return false;
+            }
+        } else if (arg == "--cam") {
+            glm::vec3& p = opts.CamPosition;
+            glm::vec2& r = opts.CamEuler;
+
+            if (sscanf(value, "%f,%f,%f,%f,%f", &p.x, &p.y, &p.z, &r.x, &r.y) != 5) {
+                std::fprintf(stderr, "Invalid camera '%s', expected x,y,z,yaw,pitch\n", value);
+                return false;
+            }
+        } else if (arg == "--fov") {
+            if (!ParseNumber(arg, value, 1.0f, 179.0f, opts.FieldOfView)) return false;
+        } else if (arg == "--frames") {
+            if (!ParseNumber(arg, value, 0u, 1000000u, opts.NumFrames)) return false;
+        } else if (arg == "--shadow-res") {
+            if (!ParseNumber(arg, value, 128u, swr::TrianglePacket::MaxViewportSize, opts.ShadowRes)) return false;
+            opts.ShadowRes = std::min((opts.ShadowRes + 64) & ~127u, swr::TrianglePacket::MaxViewportSize);
+        } else if (arg == "--exposure") {
+            if (!ParseNumber(arg, value, 0.0f, 1000.0f, opts.Exposure)) return false;
+        } else if (arg == "--ibl") {
+            if (!ParseNumber(arg, value, 0.0f, 1000.0f, opts.IntensityIBL)) return false;
+        } else if (arg == "--threads") {
+            if (!ParseNumber(arg, value, 1u, 1024u, opts.NumThreads)) return false;
+        } else if (arg == "--batch-size") {
+            if (!ParseNumber(arg, value, 1u, 1u << 24, opts.BatchSize)) return false;
+        } else if (arg == "--pages") {
+            std::string_view name = value;
+
+            if (name == "heap") {
+                opts.Memory.Pages = swr::PagePolicy::Heap;
+            } else if (name == "thp") {
+                opts.Memory.Pages = swr::PagePolicy::TransparentHuge;
+            } else if (name == "huge") {
+                opts.Memory.Pages = swr::PagePolicy::ExplicitHuge;
+            } else {
+                std::fprintf(stderr, "Unknown page policy '%s'\n", value);
+                return false;
+            }
+        } else if (arg == "--numa") {
+            std::string_view name = value;
+
+            if (name == "first-touch") {
+                opts.Memory.Numa = swr::NumaPolicy::FirstTouch;
+            } else if (name == "interleave") {
+                opts.Memory.Numa = swr::NumaPolicy::Interleave;
+            } else if (name == "partition") {
+                opts.Memory.Numa = swr::NumaPolicy::Partitioned;
+            } else {
+                std::fprintf(stderr, "Unknown NUMA policy '%s'\n", value);
+                return false;
+            }
+        } else {
+            std::fprintf(stderr, "Unknown option '%.*s'\n", (int)arg.size(), arg.data());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void PrintMemoryStats() {
+    static const char* UsageNames[] = { "Generic", "Framebuffer", "Texture", "Batch" };
+    static const char* PlacementNames[] = { "heap", "4K pages", "THP", "huge pages" };
+    swr::MemoryStats stats = swr::GetMemoryStats();
+
+    std::printf("Live buffers:\n");
+
+    for (uint32_t i = 0; i < (uint32_t)swr::MemoryUsage::_Count; i++) {
+        std::printf("  %-12s", UsageNames[i]);
+
+        for (uint32_t j = 0; j < swr::MemoryStats::_NumPlacements; j++) {
+            const swr::MemoryStats::Entry& entry = stats.Entries[i][j];
+            if (entry.NumBuffers == 0) continue;
+
+            std::printf(" %s: %llu (%.1fMB", PlacementNames[j], (unsigned long long)entry.NumBuffers, entry.NumBytes / 1048576.0);
+            if (entry.NumaBytes != 0) std::printf(", %.1fMB NUMA bound", entry.NumaBytes / 1048576.0);
+            std::printf(")");
+        }
+        std::printf("\n");
+    }
+}
+
+// Entry point of the renderer, called by main() in HeadlessMain.cpp for the selected ISA variant.
+int Run(int argc, char** args) {
+    HeadlessOptions opts;
+
+    if (!ParseOptions(argc, args, opts)) {
+        PrintUsage();
+        return 1;
+    }
+
+    swr::ThreadPool::ConfigureShared(opts.NumThreads, opts.PinThreads);
+    swr::ConfigureMemory(opts.Memory);
+
+    std::unique_ptr<HeadlessRenderer> renderer;
+
+    try {
+        renderer = std::make_unique<HeadlessRenderer>(opts);
+    } catch (const std::exception& ex) {
+        std::fprintf(stderr, "Failed to load scene: %s\n", ex.what());
+        return 1;
+    }
+
+    const auto GetTimeMs = [](swr::ProfilerStats::Key key) { return swr::g_Stats.Keys[key].Value / 1000000.0; };
+    double totalFrame = 0, totalSetup = 0, totalRaster = 0, totalCompose = 0, totalShadow = 0;
+
+    for (uint32_t i = 0; i < opts.NumFrames; i++) {
+        renderer->Render();
+
+        double frameTime = GetTimeMs(swr::ProfilerStats::FrameTime);
+        double setupTime = GetTimeMs(swr::ProfilerStats::SetupTime);
+        double rasterTime = GetTimeMs(swr::ProfilerStats::RasterizeTime);
+        double composeTime = GetTimeMs(swr::ProfilerStats::ComposeTime);
+        double shadowTime = GetTimeMs(swr::ProfilerStats::ShadowTime);
+
+        std::printf("Frame %u: %.2fms (Setup: %.2fms, Rasterize: %.2fms, Post: %.2fms, Shadow: %.2fms, %.1fK triangles)\n", i, frameTime,
+                    setupTime, rasterTime, composeTime, shadowTime, STAT_GET_COUNT(TrianglesDrawn));
+
+        totalFrame += frameTime;
+        totalSetup += setupTime;
+        totalRaster += rasterTime;
+        totalCompose += composeTime;
+        totalShadow += shadowTime;
+
+        swr::g_Stats.Reset();
+
+        if (opts.SaveFrames) {
+            renderer->SaveFrame(i);
+        }
+    }
+
+    if (opts.NumFrames > 0) {
+        double n = opts.NumFrames;
+        std::printf("Average over %u frames at %ux%u (%s, %u threads): %.2fms (%.1f FPS), Setup: %.2fms, Rasterize: %.2fms, Post: %.2fms, "
+                    "Shadow: %.2fms\n",
+                    opts.NumFrames, opts.Width, opts.Height, SWR_SIMD_NAME, swr::ThreadPool::Shared().GetNumThreads(), totalFrame / n,
+                    1000.0 * n / totalFrame, totalSetup / n, totalRaster / n, totalCompose / n, totalShadow / n);
+    }
+    if (opts.PrintMemoryStats) {
+        PrintMemoryStats();
+    }
+    return 0;
+}
+
+};  // namespace headless
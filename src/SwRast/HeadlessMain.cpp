@@ -0,0 +1,49 @@
+// Entry point of the headless renderer. In dispatch builds (SWR_RUNTIME_DISPATCH), this is compiled
+// for the baseline ISA and forwards to the best renderer variant for the running CPU.
+#include <cstdio>
+#include <cstdlib>
+
+#include "CpuDispatch.h"
+
+namespace headless {
+
+#ifdef SWR_RUNTIME_DISPATCH
+namespace isa_v3 { int Run(int argc, char** args); }
+namespace isa_v4 { int Run(int argc, char** args); }
+namespace isa_v4x { int Run(int argc, char** args); }
+#else
+inline namespace SWR_ISA_NS { int Run(int argc, char** args); }
+#endif
+
+};  // namespace headless
+
+#ifdef SWR_RUNTIME_DISPATCH
+int main(int argc, char** args) {
+    swr::IsaLevel level = swr::DetectIsaLevel();
+
+    // Allow forcing a lower level for comparisons, e.g. SWRAST_ISA=v3
+    if (const char* forced = std::getenv("SWRAST_ISA")) {
+        swr::IsaLevel forcedLevel;
+
+        if (!swr::ParseIsaLevel(forced, forcedLevel)) {
+            std::fprintf(stderr, "Unknown ISA level '%s' in SWRAST_ISA, expected v3, v4 or v4x\n", forced);
+            return 1;
+        }
+        if (forcedLevel > level) {
+            std::fprintf(stderr, "SWRAST_ISA=%s is not supported by this CPU (detected %s)\n", forced, swr::GetIsaName(level));
+            return 1;
+        }
+        level = forcedLevel;
+    }
+    std::printf("Using %s renderer\n", swr::GetIsaName(level));
+
+    switch (level) {
+        case swr::IsaLevel::X86_64_V4X: return headless::isa_v4x::Run(argc, args);
+        case swr::IsaLevel::X86_64_V4: return headless::isa_v4::Run(argc, args);
+        case swr::IsaLevel::X86_64_V3: return headless::isa_v3::Run(argc, args);
+        default: std::fprintf(stderr, "This CPU is not supported, at least x86-64-v3 (AVX2) is required\n"); return 1;
+    }
+}
+#else
+int main(int argc, char** args) { return headless::Run(argc, args); }
+#endif
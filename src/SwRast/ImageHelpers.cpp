@@ -1,13 +1,11 @@
 #include "SwRast.h"
 #include "Texture.h"
 
-#define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#include <stdexcept>
 
-namespace swr {
+namespace swr::inline SWR_ISA_NS {
 
 StbImage StbImage::Load(std::string_view path, PixelType type) {
     int width, height;
@@ -16,7 +14,7 @@ StbImage StbImage::Load(std::string_view path, PixelType type) {
                                                    nullptr;
 
     if (pixels == nullptr) {
-        throw std::exception("Failed to load image");
+        throw std::runtime_error("Failed to load image");
     }
     return {
         .Width = (uint32_t)width,
@@ -84,14 +82,14 @@ HdrTexture2D LoadCubemapFromPanoramaHDR(std::string_view path, uint32_t mipLevel
         for (uint32_t y = 0; y < faceSize; y += 4) {
             for (uint32_t x = 0; x < faceSize; x += 4) {
                 float scaleUV = 1.0f / (faceSize - 1);
-                VFloat u = simd::conv2f((int32_t)x + FragPixelOffsetsX) * scaleUV;
-                VFloat v = simd::conv2f((int32_t)y + FragPixelOffsetsY) * scaleUV;
+                VFloat u = simd::conv2f((int32_t)x + FragPixelOffsetsX()) * scaleUV;
+                VFloat v = simd::conv2f((int32_t)y + FragPixelOffsetsY()) * scaleUV;
 
                 VFloat3 dir = UnprojectCubemap(u, v, (int32_t)layer);
 
                 for (uint32_t i = 0; i < VFloat::Length; i++) {
-                    u[i] = std::atan2f(dir.z[i], dir.x[i]) / simd::tau + 0.5f;
-                    v[i] = std::asinf(-dir.y[i]) / simd::pi + 0.5f;
+                    u[i] = std::atan2(dir.z[i], dir.x[i]) / simd::tau + 0.5f;
+                    v[i] = std::asin(-dir.y[i]) / simd::pi + 0.5f;
                 }
 
                 VFloat3 tile = panoTex.Sample<PanoSampler>(u, v, (int32_t)layer);
@@ -109,17 +107,15 @@ HdrTexture2D LoadCubemapFromPanoramaHDR(std::string_view path, uint32_t mipLevel
 void Framebuffer::GetPixels(uint32_t* __restrict dest, uint32_t stride) const {
     for (uint32_t y = 0; y < Height; y += 4) {
         for (uint32_t x = 0; x < Width; x += 4) {
-            // Clang is doing some really funky vectorization with this loop. Manual vectorization ftw I guess...
+            // Clang is doing some really funky vectorization with this loop. Fixed-size row copies are lowered to plain 128-bit moves.
             // for (uint32_t sx = 0; sx < 4; sx++) {
             //     dest[y * stride + x + sx] = src[sx];
             // }
             uint32_t* src = &ColorBuffer[GetPixelOffset(x, y)];
 
-            __m512i tile = _mm512_load_si512(src);
-            _mm_storeu_si128((__m128i*)&dest[(y + 0) * stride + x], _mm512_extracti32x4_epi32(tile, 0));
-            _mm_storeu_si128((__m128i*)&dest[(y + 1) * stride + x], _mm512_extracti32x4_epi32(tile, 1));
-            _mm_storeu_si128((__m128i*)&dest[(y + 2) * stride + x], _mm512_extracti32x4_epi32(tile, 2));
-            _mm_storeu_si128((__m128i*)&dest[(y + 3) * stride + x], _mm512_extracti32x4_epi32(tile, 3));
+            for (uint32_t sy = 0; sy < 4; sy++) {
+                std::memcpy(&dest[(y + sy) * stride + x], &src[sy * 4], 16);
+            }
         }
     }
 }
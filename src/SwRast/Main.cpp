@@ -45,6 +45,7 @@ class SwRenderer {
     std::string _currSceneName, _currSkyboxName;
 
     renderer::SSAO _ssao;
+    renderer::VisibilityBuffer _visBuffer;
 
 public:
     SwRenderer() {
@@ -68,7 +69,7 @@ public:
     }
 
     void InitRasterizer(uint32_t width, uint32_t height) {
-        _fb = std::make_shared<swr::Framebuffer>(width, height, renderer::DefaultShader::NumFbAttachments);
+        _fb = std::make_shared<swr::Framebuffer>(width, height, renderer::DefaultShader::FbAttachments);
         _rast = std::make_unique<swr::Rasterizer>(_fb);
 
         _frontTex = std::make_unique<ogl::Texture2D>(_fb->Width, _fb->Height, 1, GL_RGBA8);
@@ -100,6 +101,8 @@ public:
 
         static bool s_EnableSSAO = false;
         static bool s_HzbOcclusion = true;
+        static bool s_VisibilityBuffer = false;
+        static bool s_FusedCompose = true;
         static bool s_AnimateLight = false;
         static bool s_VSync = true;
 
@@ -141,6 +144,8 @@ public:
         ImGui::SliderFloat("Exposure", &_shader->Exposure, 0.1f, 5.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
         ImGui::SliderFloat("IBL Intensity", &_shader->IntensityIBL, 0.0f, 1.0f, "%.2f");
         ImGui::Checkbox("Hier-Z Occlusion", &s_HzbOcclusion);
+        ImGui::Checkbox("Visibility Buffer", &s_VisibilityBuffer);
+        ImGui::Checkbox("Fused Compose", &s_FusedCompose);
         if (ImGui::Checkbox("VSync", &s_VSync)) {
             glfwSwapInterval(s_VSync ? 1 : 0);
         }
@@ -151,7 +156,7 @@ public:
         if (s_EnableShadows) {
             ImGui::Indent();
             ImGui::InputFloat("Range##Shadow", &s_ShadowRange, 0.5f);
-            if (ImGui::SliderInt("Resolution##Shadow", &s_ShadowRes, 128, 2048)) {
+            if (ImGui::SliderInt("Resolution##Shadow", &s_ShadowRes, 128, 8192)) {
                 s_ShadowRes = (s_ShadowRes + 64) & ~127;
             }
             ImGui::Checkbox("Follow Camera", &s_ShadowFollowCam);
@@ -220,24 +225,54 @@ public:
 
                 if (s_HzbOcclusion && !_depthPyramid.IsVisible(mesh, modelMat)) continue;
 
-                _shader->ProjMat = projViewMat * modelMat;
-                _shader->ModelMat = modelMat;
-                _shader->MaterialTex = mesh.Material->Texture;
-
                 swr::VertexReader data(
                     (uint8_t*)&_scene->VertexBuffer[mesh.VertexOffset], 
                     (uint8_t*)&_scene->IndexBuffer[mesh.IndexOffset],
-                    mesh.IndexCount, swr::VertexReader::U16);
+                    mesh.IndexCount, swr::VertexReader::U16, mesh.VertexCount);
 
                 if (s_Layer == renderer::DebugLayer::Overdraw) {
-                    _rast->Draw(data, renderer::OverdrawShader{ .ProjMat = _shader->ProjMat });
+                    _rast->Submit(data, renderer::OverdrawShader{ .ProjMat = projViewMat * modelMat });
                 } else {
-                    _rast->Draw(data, *_shader);
+                    renderer::SurfaceShader shader = {
+                        .ProjMat = projViewMat * modelMat,
+                        .ModelMat = modelMat,
+                        .MaterialTex = mesh.Material->Texture,
+                    };
+                    if (s_VisibilityBuffer) {
+                        _visBuffer.Submit(*_rast, data, shader, mesh.Material->AlphaTested);
+                    } else {
+                        _rast->Submit(data, shader);
+                    }
                 }
                 drawCalls++;
             }
             return true;
         });
+        _shader->ProjMat = projViewMat;
+
+        // Debug layers and SSAO need the whole G-Buffer, so they can't be fused with rasterization.
+        bool fusedCompose = s_FusedCompose && !s_EnableSSAO && s_Layer == renderer::DebugLayer::None;
+
+        if (fusedCompose) {
+            _rast->Flush([&](uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+                if (s_VisibilityBuffer) {
+                    _visBuffer.ResolveRegion(*_fb, x, y, width, height);
+                }
+                _shader->ComposeRegion(*_fb, x, y, width, height);
+            });
+            if (s_VisibilityBuffer) {
+                _visBuffer.EndResolve();
+            }
+            _shader->EndCompose(*_fb);
+        } else {
+            _rast->Flush();
+        }
+
+        if (s_VisibilityBuffer && !fusedCompose && s_Layer != renderer::DebugLayer::Overdraw) {
+            STAT_TIME_BEGIN(Rasterize);
+            _visBuffer.Resolve(*_fb);
+            STAT_TIME_END(Rasterize);
+        }
 
         STAT_TIME_BEGIN(Compose);
 
@@ -249,10 +284,8 @@ public:
             _ssao.Generate(*_fb, _depthPyramid, projViewMat);
         }
 
-        _shader->ProjMat = projViewMat;
-
         if (s_Layer == renderer::DebugLayer::None) {
-            _shader->Compose(*_fb, s_EnableSSAO, *_prevFb);
+            if (!fusedCompose) _shader->Compose(*_fb, s_EnableSSAO, *_prevFb);
         } else if (s_Layer != renderer::DebugLayer::Overdraw) {
             _shader->ComposeDebug(*_fb, s_Layer);
         }
@@ -269,11 +302,23 @@ public:
         auto texId = (ImTextureID)(uintptr_t)_frontTex->Handle;
         drawList->AddImage(texId, drawList->GetClipRectMin(), drawList->GetClipRectMax(), ImVec2(0, 1), ImVec2(1, 0));
 
+        swr::MemoryStats memStats = swr::GetMemoryStats();
+        double memTotalMB = 0, memHugeMB = 0;
+
+        for (auto& entries : memStats.Entries) {
+            for (uint32_t i = 0; i < swr::MemoryStats::_NumPlacements; i++) {
+                memTotalMB += entries[i].NumBytes / 1048576.0;
+                if (i >= swr::MemoryStats::TransparentHuge) memHugeMB += entries[i].NumBytes / 1048576.0;
+            }
+        }
+
         // clang-format off
         ImGui::Begin("Rasterizer Stats");
         ImGui::Text("Frame: %.1fms (%.0f FPS), Shadow: %.1fms, Post: %.2fms", STAT_GET_TIME(Frame), 1000.0 / STAT_GET_TIME(Frame), STAT_GET_TIME(Shadow), STAT_GET_TIME(Compose));
         ImGui::Text("Setup: %.1fms (%.1fK vertices), Rasterize: %.2fms", STAT_GET_TIME(Setup), STAT_GET_COUNT(VerticesShaded), STAT_GET_TIME(Rasterize));
         ImGui::Text("Triangles: %.1fK (%.1fK clipped, %.1fK bins, %d calls)", STAT_GET_COUNT(TrianglesDrawn), STAT_GET_COUNT(TrianglesClipped), STAT_GET_COUNT(BinsFilled), drawCalls);
+        ImGui::Text("Bin chunks: %.1fK (up to %d per bin)", STAT_GET_COUNT(BinChunks), (int)swr::g_Stats.Keys[swr::ProfilerStats::BinChunksMax].Value);
+        ImGui::Text("Buffers: %.1fMB (%.1fMB in huge pages)", memTotalMB, memHugeMB);
         ImGui::End();
         // clang-format on
 
@@ -301,12 +346,13 @@ public:
                 swr::VertexReader data(
                     (uint8_t*)&_shadowScene->VertexBuffer[mesh.VertexOffset],
                     (uint8_t*)&_shadowScene->IndexBuffer[mesh.IndexOffset],
-                    mesh.IndexCount, swr::VertexReader::U16);
+                    mesh.IndexCount, swr::VertexReader::U16, mesh.VertexCount);
 
-                _shadowRast->Draw(data, renderer::DepthOnlyShader{ .ProjMat = _shadowProjMat * modelMat });
+                _shadowRast->Submit(data, renderer::DepthOnlyShader{ .ProjMat = _shadowProjMat * modelMat });
             }
             return true;
         });
+        _shadowRast->Flush();
         
         ImGui::SetNextWindowCollapsed(true, ImGuiCond_Appearing);
         if (ImGui::Begin("Shadow Debug")) {
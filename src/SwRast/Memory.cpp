@@ -0,0 +1,231 @@
+// Allocation of large buffers, see Memory.h. This is ISA independent like Common.cpp.
+#include "Memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+
+#include "ThreadPool.h"
+
+#ifdef __linux__
+    #include <linux/mempolicy.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace swr {
+
+static const size_t HugePageSize = 2 * 1024 * 1024;
+static const size_t SmallPageSize = 4096;
+
+// Stored right before each buffer, so that FreeMemory() can release it the same way it was allocated.
+struct AllocHeader {
+    void* Base;
+    size_t MappedSize;  // 0 for heap buffers
+    size_t Size;
+    MemoryUsage Usage;
+    MemoryStats::Placement Placement;
+    bool NumaBound;
+};
+
+struct AtomicStatsEntry {
+    std::atomic<uint64_t> NumBuffers, NumBytes, NumaBytes;
+};
+
+static MemoryConfig s_Config;
+static AtomicStatsEntry s_Stats[(uint32_t)MemoryUsage::_Count][MemoryStats::_NumPlacements];
+
+void ConfigureMemory(const MemoryConfig& config) { s_Config = config; }
+const MemoryConfig& GetMemoryConfig() { return s_Config; }
+
+MemoryStats GetMemoryStats() {
+    MemoryStats stats;
+
+    for (uint32_t i = 0; i < (uint32_t)MemoryUsage::_Count; i++) {
+        for (uint32_t j = 0; j < MemoryStats::_NumPlacements; j++) {
+            stats.Entries[i][j] = {
+                .NumBuffers = s_Stats[i][j].NumBuffers.load(std::memory_order_relaxed),
+                .NumBytes = s_Stats[i][j].NumBytes.load(std::memory_order_relaxed),
+                .NumaBytes = s_Stats[i][j].NumaBytes.load(std::memory_order_relaxed),
+            };
+        }
+    }
+    return stats;
+}
+static void UpdateStats(const AllocHeader& hdr, bool add) {
+    AtomicStatsEntry& entry = s_Stats[(uint32_t)hdr.Usage][hdr.Placement];
+    uint64_t sign = add ? 1 : ~0ull;  // -1, counters wrap around
+
+    entry.NumBuffers.fetch_add(sign, std::memory_order_relaxed);
+    entry.NumBytes.fetch_add(hdr.Size * sign, std::memory_order_relaxed);
+    if (hdr.NumaBound) entry.NumaBytes.fetch_add(hdr.Size * sign, std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+// Parses "node<N>" entries from sysfs, returns -1 for anything else.
+static int32_t ParseNodeName(const std::string& name) {
+    if (!name.starts_with("node") || name.size() == 4) return -1;
+
+    for (size_t i = 4; i < name.size(); i++) {
+        if (name[i] < '0' || name[i] > '9') return -1;
+    }
+    return std::stoi(name.substr(4));
+}
+static const std::vector<uint32_t>& GetNumaNodes() {
+    static const std::vector<uint32_t> nodes = []() {
+        std::vector<uint32_t> list;
+        std::error_code ec;
+
+        for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+            int32_t node = ParseNodeName(entry.path().filename().string());
+            if (node >= 0) list.push_back((uint32_t)node);
+        }
+        std::sort(list.begin(), list.end());
+        return list;
+    }();
+    return nodes;
+}
+static int32_t GetCoreNode(uint32_t core) {
+    std::error_code ec;
+
+    for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/cpu/cpu" + std::to_string(core), ec)) {
+        int32_t node = ParseNodeName(entry.path().filename().string());
+        if (node >= 0) return node;
+    }
+    return -1;
+}
+
+// Sets the policy of a page aligned range through the raw syscall, so that libnuma isn't needed.
+static bool BindPages(uint8_t* ptr, size_t size, int mode, std::span<const uint32_t> nodes) {
+    const uint32_t MaxNodes = 1024;
+    unsigned long mask[MaxNodes / 64] = {};
+
+    for (uint32_t node : nodes) {
+        if (node < MaxNodes) mask[node / 64] |= 1ul << (node % 64);
+    }
+    return syscall(SYS_mbind, ptr, size, mode, mask, MaxNodes + 1, 0) == 0;
+}
+
+// Must be called before the pages are touched. `dataOffset` and `dataSize` delimit the buffer in the mapping.
+static bool ApplyNumaPolicy(uint8_t* base, size_t mappedSize, size_t pageSize, size_t dataOffset, size_t dataSize, int32_t ownerThread) {
+    const std::vector<uint32_t>& nodes = GetNumaNodes();
+    if (s_Config.Numa == NumaPolicy::FirstTouch || nodes.size() < 2) return false;
+
+    std::span<const uint32_t> cores;
+    if (s_Config.Numa == NumaPolicy::Partitioned) cores = ThreadPool::Shared().GetPinnedCores();
+
+    if (cores.empty()) {
+        return BindPages(base, mappedSize, MPOL_INTERLEAVE, nodes);
+    }
+    if (ownerThread >= 0) {
+        int32_t node = GetCoreNode(cores[(uint32_t)ownerThread % cores.size()]);
+        if (node < 0) return false;
+
+        uint32_t nodeMask[1] = { (uint32_t)node };
+        return BindPages(base, mappedSize, MPOL_PREFERRED, nodeMask);
+    }
+    // Same split as ParallelFor(), ranges are rounded to pages. Buffers indexed by bin (e.g. framebuffers) then
+    // mostly live on the node of the thread that starts with those bins in Framebuffer::IterateTiles().
+    uint32_t numRanges = (uint32_t)cores.size();
+    bool bound = true;
+
+    for (uint32_t i = 0; i < numRanges; i++) {
+        size_t start = i == 0 ? 0 : (dataOffset + dataSize * i / numRanges) & ~(pageSize - 1);
+        size_t end = i + 1 == numRanges ? mappedSize : (dataOffset + dataSize * (i + 1) / numRanges) & ~(pageSize - 1);
+        int32_t node = GetCoreNode(cores[i]);
+
+        if (start >= end || node < 0) continue;
+
+        uint32_t nodeMask[1] = { (uint32_t)node };
+        bound &= BindPages(base + start, end - start, MPOL_PREFERRED, nodeMask);
+    }
+    return bound;
+}
+
+static uint8_t* MapPages(size_t size, AllocHeader& hdr) {
+    const int prot = PROT_READ | PROT_WRITE, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (s_Config.Pages == PagePolicy::ExplicitHuge) {
+        size_t mappedSize = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+        void* ptr = mmap(nullptr, mappedSize, prot, flags | MAP_HUGETLB, -1, 0);
+
+        if (ptr != MAP_FAILED) {
+            hdr.MappedSize = mappedSize;
+            hdr.Placement = MemoryStats::ExplicitHuge;
+            return (uint8_t*)ptr;
+        }
+    }
+    // Transparent huge pages only back aligned 2MB ranges, so map a bit more and trim to a huge page boundary.
+    size_t mappedSize = (size + SmallPageSize - 1) & ~(SmallPageSize - 1);
+    void* ptr = mmap(nullptr, mappedSize + HugePageSize, prot, flags, -1, 0);
+    if (ptr == MAP_FAILED) return nullptr;
+
+    uint8_t* start = (uint8_t*)(((uintptr_t)ptr + HugePageSize - 1) & ~(HugePageSize - 1));
+    size_t headSize = (size_t)(start - (uint8_t*)ptr);
+
+    if (headSize != 0) munmap(ptr, headSize);
+    munmap(start + mappedSize, HugePageSize - headSize);
+
+    hdr.MappedSize = mappedSize;
+    hdr.Placement = madvise(start, mappedSize, MADV_HUGEPAGE) == 0 ? MemoryStats::TransparentHuge : MemoryStats::Mapped;
+    return start;
+}
+
+#endif
+
+void* AllocMemory(size_t size, size_t align, MemoryUsage usage, int32_t ownerThread) {
+    assert(std::has_single_bit(align) && align <= SmallPageSize);
+
+    // The header goes in the padding before the buffer
+    size_t headerSize = (sizeof(AllocHeader) + align - 1) & ~(align - 1);
+    AllocHeader hdr = { .Base = nullptr, .MappedSize = 0, .Size = size, .Usage = usage, .Placement = MemoryStats::Heap, .NumaBound = false };
+    uint8_t* base = nullptr;
+
+#ifdef __linux__
+    if (s_Config.Pages != PagePolicy::Heap && size >= s_Config.MinMappedSize) {
+        base = MapPages(headerSize + size, hdr);
+
+        if (base != nullptr) {
+            // Partitions are split at huge page boundaries where possible, pages can't be shared by two nodes
+            size_t pageSize = hdr.Placement == MemoryStats::Mapped ? SmallPageSize : HugePageSize;
+            hdr.NumaBound = ApplyNumaPolicy(base, hdr.MappedSize, pageSize, headerSize, size, ownerThread);
+        }
+    }
+#endif
+    if (base == nullptr) {
+        base = (uint8_t*)_mm_malloc(headerSize + size, std::max(align, alignof(AllocHeader)));
+        if (base == nullptr) return nullptr;
+    }
+    hdr.Base = base;
+    UpdateStats(hdr, true);
+
+    uint8_t* ptr = base + headerSize;
+    std::memcpy(ptr - sizeof(AllocHeader), &hdr, sizeof(AllocHeader));
+    return ptr;
+}
+
+void FreeMemory(void* ptr) {
+    if (ptr == nullptr) return;
+
+    AllocHeader hdr;
+    std::memcpy(&hdr, (uint8_t*)ptr - sizeof(AllocHeader), sizeof(AllocHeader));
+    UpdateStats(hdr, false);
+
+#ifdef __linux__
+    if (hdr.MappedSize != 0) {
+        munmap(hdr.Base, hdr.MappedSize);
+        return;
+    }
+#endif
+    _mm_free(hdr.Base);
+}
+
+};  // namespace swr
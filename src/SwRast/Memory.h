@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace swr {
+
+// What a buffer is used for, only to break down MemoryStats.
+enum class MemoryUsage : uint8_t { Generic, Framebuffer, Texture, Batch, _Count };
+
+// How the pages of large buffers are requested from the OS. Buffers below `MemoryConfig::MinMappedSize`
+// and all buffers on platforms other than Linux come from the heap.
+enum class PagePolicy : uint8_t {
+    Heap,             // Aligned malloc, whatever page size the C runtime uses
+    TransparentHuge,  // Anonymous mapping advised with MADV_HUGEPAGE, backed by 2MB pages when the kernel has them
+    ExplicitHuge,     // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falls back to TransparentHuge when exhausted
+};
+
+// Where the pages of mapped buffers are placed on machines with several NUMA nodes. Ignored on single node machines.
+enum class NumaPolicy : uint8_t {
+    FirstTouch,   // OS default, pages go to the node of the thread that first writes them
+    Interleave,   // Pages are spread round-robin over all nodes
+    Partitioned,  // Buffers are split in one contiguous range per thread, like ThreadPool::ParallelFor() splits its indices,
+                  // and each range prefers the node of the core its thread is pinned to. Interleaves if threads are not pinned.
+                  // For framebuffers this matches passes that go through Framebuffer::IterateTiles(). The rasterizer
+                  // schedules bins heaviest first, so threads draw to bins on any node.
+};
+
+struct MemoryConfig {
+    PagePolicy Pages = PagePolicy::TransparentHuge;
+    NumaPolicy Numa = NumaPolicy::FirstTouch;
+    size_t MinMappedSize = 1024 * 1024;
+};
+
+// Only affects buffers allocated afterwards, so this should be called at startup, after ThreadPool::ConfigureShared().
+void ConfigureMemory(const MemoryConfig& config);
+const MemoryConfig& GetMemoryConfig();
+
+// Returns uninitialized memory aligned to `align` bytes (at most 4096), which must be released with FreeMemory().
+// With NumaPolicy::Partitioned, `ownerThread` places the whole buffer on the node of that thread rather than splitting it.
+void* AllocMemory(size_t size, size_t align, MemoryUsage usage, int32_t ownerThread = -1);
+void FreeMemory(void* ptr);
+
+// Live buffers, by usage and by what they actually got. This may be less than requested if the OS refused.
+struct MemoryStats {
+    enum Placement { Heap, Mapped, TransparentHuge, ExplicitHuge, _NumPlacements };
+    struct Entry {
+        uint64_t NumBuffers, NumBytes;
+        uint64_t NumaBytes;  // Bytes with an explicit NUMA policy (interleaved or partitioned)
+    };
+    Entry Entries[(uint32_t)MemoryUsage::_Count][_NumPlacements];
+};
+MemoryStats GetMemoryStats();
+
+};  // namespace swr
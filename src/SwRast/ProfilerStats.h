@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 namespace swr {
@@ -10,6 +11,8 @@ struct ProfilerStats {
         TrianglesClipped,
         VerticesShaded,
         BinsFilled,
+        BinChunks,     // Bin chunks used by all setup threads, see TriangleBatch::Bins
+        BinChunksMax,  // Most chunks used by a bin of a single setup thread
 
         SetupTime,
         RasterizeTime,
@@ -38,10 +41,19 @@ struct ProfilerStats {
     }
 
     static uint64_t CurrentTime();
+
+    static void AtomicMax(uint64_t& dest, uint64_t value) {
+        std::atomic_ref<uint64_t> ref(dest);
+        uint64_t curr = ref.load(std::memory_order_relaxed);
+        while (curr < value && !ref.compare_exchange_weak(curr, value, std::memory_order_relaxed)) {}
+    }
 };
 extern ProfilerStats g_Stats;
 
-#define STAT_INCREMENT(key, amount) (swr::g_Stats.Keys[swr::ProfilerStats::Key::key].Value += amount)
+// Counters may be incremented from multiple threads, timers only from the thread that submits work.
+#define STAT_INCREMENT(key, amount) \
+    (std::atomic_ref(swr::g_Stats.Keys[swr::ProfilerStats::Key::key].Value).fetch_add(amount, std::memory_order_relaxed))
+#define STAT_MAX(key, value) (swr::ProfilerStats::AtomicMax(swr::g_Stats.Keys[swr::ProfilerStats::Key::key].Value, value))
 #define STAT_TIME_BEGIN(key) uint64_t _stt_##key = swr::ProfilerStats::CurrentTime()
 #define STAT_TIME_END(key) (swr::g_Stats.Keys[swr::ProfilerStats::Key::key##Time].Value += swr::ProfilerStats::CurrentTime() - _stt_##key)
 
@@ -1,131 +1,462 @@
 
+#include <algorithm>
 #include <array>
-#include <chrono>
-#include <execution>
-#include <ranges>
+#include <numeric>
 
 #include "SwRast.h"
+#include "ThreadPool.h"
 
-namespace swr {
+namespace swr::inline SWR_ISA_NS {
 
-Rasterizer::Rasterizer(std::shared_ptr<Framebuffer> fb) {
-    const float maxViewSize = 2048.0f;
-    _clipper.GuardBandPlaneDistXY[0] = maxViewSize / fb->Width;
-    _clipper.GuardBandPlaneDistXY[1] = maxViewSize / fb->Height;
+Rasterizer::Rasterizer(std::shared_ptr<Framebuffer> fb, uint32_t batchCapacity) {
+    assert(fb->Width <= TrianglePacket::MaxViewportSize && fb->Height <= TrianglePacket::MaxViewportSize);
+    _fb = std::move(fb);
+    // Batches must fit at least one setup chunk
+    _batchCapacity = std::max(batchCapacity, SetupChunkSize * TriangleBatch::MaxPacketsPerInput * VFloat::Length);
+}
 
-    _batch = std::make_unique<TriangleBatch>(fb->Width, fb->Height);
+// Smaller bins balance better across many threads, larger ones have less overhead per triangle.
+uint32_t Rasterizer::ChooseBinSizeLog2(uint32_t numThreads) const {
+    const uint32_t TargetBinsPerThread = 8;
+    uint32_t binSizeLog2 = TriangleBatch::MaxBinSizeLog2;
 
-    _fb = std::move(fb);
+    while (binSizeLog2 > TriangleBatch::MinBinSizeLog2) {
+        uint32_t binSize = 1u << binSizeLog2;
+        uint32_t numBins = ((_fb->Width + binSize - 1) >> binSizeLog2) * ((_fb->Height + binSize - 1) >> binSizeLog2);
+        if (numBins >= numThreads * TargetBinsPerThread) break;
+
+        binSizeLog2--;
+    }
+    return binSizeLog2;
 }
 
-void Rasterizer::Draw(VertexReader& vertexData, const ShaderInterface& shader) {
-    uint32_t pos = 0;
-    uint32_t count = vertexData.Count / 3;
+void Rasterizer::Flush(const BinCallback& onBinDone) {
+    ThreadPool& pool = ThreadPool::Shared();
+    uint32_t binSizeLog2 = ChooseBinSizeLog2(pool.GetNumThreads());
 
-    while (pos < count) {
-        TriangleBatch& batch = *_batch;
+    // Bins are visited once more after their last triangle to resolve pending clears and call `onBinDone`.
+    bool resolveClears = _fb->HasPendingClears;
 
-        STAT_TIME_BEGIN(Setup);
+    const auto FinishBin = [&](uint32_t x, uint32_t y, uint32_t size) {
+        uint32_t width = std::min(_fb->Width - x, size), height = std::min(_fb->Height - y, size);
 
-        for (; pos < count && !batch.IsFull(); pos += VFloat::Length) {
-            TrianglePacket& tri = batch.Alloc();
+        if (resolveClears) _fb->ResolveClears(x, y, width, height);
+        if (onBinDone) onBinDone(x, y, width, height);
+    };
 
-            // Read vertices and assemble triangles
-            shader.ReadVtxFn(pos * 3, tri.Vertices);
+    if (_draws.empty()) {
+        if (resolveClears || onBinDone) {
+            uint32_t binSize = 1u << binSizeLog2;
+            uint32_t binsPerRow = (_fb->Width + binSize - 1) >> binSizeLog2;
 
-            // Clip, setup, and bin
-            SetupTriangles(batch, shader.NumCustomAttribs);
+            pool.ParallelFor(((_fb->Height + binSize - 1) >> binSizeLog2) * binsPerRow, 1, [&](uint32_t binId) {
+                FinishBin((binId % binsPerRow) * binSize, (binId / binsPerRow) * binSize, binSize);
+            });
         }
+        _fb->HasPendingClears = false;
+        return;
+    }
+    uint32_t numThreads = std::min(pool.GetNumThreads(), MaxSetupThreads);
+
+    if (_batches[0].size() != numThreads || _batches[0][0]->BinSizeLog2 != binSizeLog2) {
+        float guardBandSize = (float)TrianglePacket::GetGuardBandSize(std::max(_fb->Width, _fb->Height));
+
+        _clippers = std::make_unique<Clipper[]>(numThreads);
 
-        STAT_TIME_END(Setup);
+        for (uint32_t i = 0; i < numThreads; i++) {
+            _clippers[i].GuardBandPlaneDistXY[0] = guardBandSize / _fb->Width;
+            _clippers[i].GuardBandPlaneDistXY[1] = guardBandSize / _fb->Height;
+        }
+        for (BatchSet& set : _batches) {
+            set.clear();
 
-        if (batch.Count == 0) continue;
+            for (uint32_t i = 0; i < numThreads; i++) {
+                set.push_back(std::make_unique<TriangleBatch>(_fb->Width, _fb->Height, binSizeLog2, _batchCapacity, i));
+            }
+        }
+    }
+
+    // Chunks never span across draws, so that each packet belongs to a single draw
+    SetupQueue queue = { .PassEnd = 0, .NumChunks = 0 };
+
+    uint32_t numVertexPackets = 0;
+    size_t vertexCacheSize = 0;
+
+    for (DrawCall& draw : _draws) {
+        draw.FirstChunk = queue.NumChunks;
+        queue.NumChunks += (draw.NumTriangles + SetupChunkSize * VFloat::Length - 1) / (SetupChunkSize * VFloat::Length);
+
+        draw.FirstVertexPacket = numVertexPackets;
+        draw.VertexCacheOffset = vertexCacheSize;
+        numVertexPackets += draw.NumVertexPackets;
+        vertexCacheSize += draw.NumVertexPackets * (4 + draw.Shader.NumCustomAttribs);
+    }
+    if (vertexCacheSize > _vertexCacheCapacity) {
+        _vertexCacheCapacity = vertexCacheSize + vertexCacheSize / 4;
+        _vertexCache = alloc_buffer<VFloat>(_vertexCacheCapacity, MemoryUsage::Batch);
+    }
+
+    const auto BeginPass = [&]() {
+        queue.PassStart = queue.PassEnd;
+        queue.PassEnd = std::min(queue.NumChunks, queue.PassStart + 65536);  // chunk ids are 16-bit
+        queue.NextChunk = queue.PassStart;
+    };
+    const auto EndPass = [&]() { queue.PassEnd = std::min(queue.NextChunk.load(), queue.PassEnd); };
+
+    // Fill the first set of batches, then rasterize each set while the other one is being filled.
+    // Setup and bin tasks go in the same parallel loop, so that threads can steal from either.
+    STAT_TIME_BEGIN(Setup);
+    if (numVertexPackets != 0) ShadeVertexPackets();
+
+    BeginPass();
+    pool.ParallelFor(numThreads, 1, [&](uint32_t i) { SetupChunks(*_batches[0][i], _clippers[i], queue); });
+    EndPass();
+    STAT_TIME_END(Setup);
+
+    bool finishedBins = false;
+
+    for (uint32_t curr = 0;; curr ^= 1) {
+        BatchSet& batches = _batches[curr];
+        BatchSet& nextBatches = _batches[curr ^ 1];
+
+        bool hasMore = queue.PassEnd < queue.NumChunks;
+        bool hasTriangles = std::any_of(batches.begin(), batches.end(), [](auto& b) { return b->Count != 0; });
+        // The last pass visits all bins if they need to be finished, empty or not.
+        bool finishBins = (resolveClears || onBinDone) && !hasMore && !finishedBins;
+        uint32_t numSetupTasks = hasMore ? numThreads : 0;
+
+        _binTasks.clear();
+        if (hasTriangles || finishBins) ScheduleBins(batches, finishBins);
+
+        if (_binTasks.empty() && numSetupTasks == 0) break;
 
         STAT_TIME_BEGIN(Rasterize);
+        if (hasMore) BeginPass();
 
-        auto binRange = std::ranges::iota_view(0u, batch.NumBins);
+        ScheduleTasks(numSetupTasks);
 
-        std::for_each(std::execution::par_unseq, binRange.begin(), binRange.end(), [&](uint32_t bid) {
-            std::vector<uint16_t>& bin = batch.Bins[bid];
-            if (bin.size() == 0) return;
+        pool.ParallelFor((uint32_t)_taskOrder.size(), 1, [&](uint32_t i) {
+            uint32_t task = _taskOrder[i];
 
-            BinnedTriangle bt = {
-                .X = (bid % batch.BinsPerRow) * TriangleBatch::BinSize,
-                .Y = (bid / batch.BinsPerRow) * TriangleBatch::BinSize,
-            };
-            for (uint16_t triangleId : bin) {
-                bt.Triangle = &batch.Triangles[triangleId / VFloat::Length];
-                bt.TriangleIndex = triangleId % VFloat::Length;
-                shader.DrawFn(bt);
+            if (task < numSetupTasks) {
+                SetupChunks(*nextBatches[task], _clippers[task], queue);
+            } else {
+                const BinTask& bin = _binTasks[task - numSetupTasks];
+                RasterizeBin(batches, bin);
+                if (finishBins) FinishBin(bin.X, bin.Y, bin.Size);
             }
-            bin.clear();
         });
-        batch.Count = 0;
+        if (hasMore) EndPass();
+        finishedBins |= finishBins;
 
+        for (auto& batch : batches) {
+            batch->Reset();
+        }
         STAT_TIME_END(Rasterize);
     }
+    _fb->HasPendingClears = false;
+    _draws.clear();
+    _drawArena.Reset();
 }
 
-void Rasterizer::SetupTriangles(TriangleBatch& batch, uint32_t numCustomAttribs) {
-    TrianglePacket& tri = batch.PeekLast();
-    Clipper::ClipCodes cc = _clipper.ComputeClipCodes(tri);
-    uint32_t addedTriangles = 0;
-    uint32_t numAttribs = numCustomAttribs + 4;
+void Rasterizer::ShadeVertexPackets() {
+    ThreadPool::Shared().ParallelFor(_draws.back().FirstVertexPacket + _draws.back().NumVertexPackets, 0, [&](uint32_t i) {
+        auto drawItr = std::upper_bound(_draws.begin(), _draws.end(), i,
+                                        [](uint32_t p, const DrawCall& draw) { return p < draw.FirstVertexPacket; });
+        const DrawCall& draw = *(drawItr - 1);
 
-    // Clip non-trivial triangles
-    for (uint32_t i : BitIter(cc.NonTrivialMask)) {
-        _clipper.LoadTriangle(tri, i, numAttribs);
+        ShadedVertexPacket vertices;
+        draw.Shader.ShadeVtxFn(draw.Shader.State, (i - draw.FirstVertexPacket) * VInt::Length, vertices);
 
-        for (uint32_t j : BitIter(cc.OutCodes[i])) {
-            _clipper.ClipAgainstPlane((Clipper::Plane)j, numAttribs);
+        uint32_t stride = 4 + draw.Shader.NumCustomAttribs;
+        VFloat* dest = &_vertexCache[draw.VertexCacheOffset + (i - draw.FirstVertexPacket) * stride];
+        dest[0] = vertices.Position.x;
+        dest[1] = vertices.Position.y;
+        dest[2] = vertices.Position.z;
+        dest[3] = vertices.Position.w;
+
+        for (uint32_t j = 0; j < draw.Shader.NumCustomAttribs; j++) {
+            dest[4 + j] = vertices.Attribs[j];
         }
+    });
+}
+
+void Rasterizer::ReadCachedTriangles(const DrawCall& draw, size_t offset, ShadedVertexPacket vertices[3]) {
+    VertexReader reader = *draw.Vertices;
+    VInt indices[3];
+    reader.ReadTriangleIndices(offset, indices);
+
+    const VFloat* packets = &_vertexCache[draw.VertexCacheOffset];
+    uint32_t numAttribs = draw.Shader.NumCustomAttribs;
+    int32_t packetStride = (int32_t)((4 + numAttribs) * sizeof(VFloat));
+    const uint32_t laneBits = std::countr_zero(VInt::Length);
+
+    for (uint32_t vi = 0; vi < 3; vi++) {
+        // Lanes past the end of the draw and out of range indices must not gather outside of its cached vertices.
+        // Indices above INT32_MAX are negative here, so both ends are clamped.
+        VInt index = simd::max(simd::min(indices[vi], (int32_t)reader.VertexCount - 1), 0);
 
-        if (_clipper.Count < 2) continue;
+        // Byte offset of each vertex from the start of the draw: packet * stride + lane
+        VInt offsets = (index >> laneBits) * packetStride + (index & (int32_t)(VInt::Length - 1)) * (int32_t)sizeof(float);
+        ShadedVertexPacket& vtx = vertices[vi];
 
-        // Triangulate result polygon
-        for (uint32_t j = 0; j < _clipper.Count - 2; j++) {
-            uint32_t usedMask = cc.AcceptMask | (cc.NonTrivialMask & (~1u << i));
-            uint32_t freeIdx = (uint32_t)std::countr_one(usedMask);
+        vtx.Position.x = VFloat::gather(&packets[0], offsets);
+        vtx.Position.y = VFloat::gather(&packets[1], offsets);
+        vtx.Position.z = VFloat::gather(&packets[2], offsets);
+        vtx.Position.w = VFloat::gather(&packets[3], offsets);
 
-            if (freeIdx < VFloat::Length) {
-                _clipper.StoreTriangle(tri, freeIdx, j, numAttribs);
-                cc.AcceptMask |= 1u << freeIdx;
+        for (uint32_t j = 0; j < numAttribs; j++) {
+            vtx.Attribs[j] = VFloat::gather(&packets[4 + j], offsets);
+        }
+    }
+}
+
+void Rasterizer::SetupChunks(TriangleBatch& batch, Clipper& clipper, SetupQueue& queue) {
+    while (batch.CanFit(SetupChunkSize)) {
+        uint32_t chunk = queue.NextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= queue.PassEnd) break;
+
+        // Find the draw this chunk belongs to
+        auto drawItr = std::upper_bound(_draws.begin(), _draws.end(), chunk,
+                                        [](uint32_t c, const DrawCall& draw) { return c < draw.FirstChunk; });
+        const DrawCall& draw = *(drawItr - 1);
+        const ShaderInterface& shader = draw.Shader;
+
+        uint32_t pos = (chunk - draw.FirstChunk) * SetupChunkSize * VFloat::Length;
+        uint32_t end = std::min(pos + SetupChunkSize * VFloat::Length, draw.NumTriangles);
+        batch.ChunkId = chunk - queue.PassStart;
+        batch.DrawId = (uint32_t)(drawItr - 1 - _draws.begin());
+
+        for (; pos < end; pos += VFloat::Length) {
+            TrianglePacket& tri = batch.Alloc();
+            tri.PrimitiveId = VInt::ramp() + (int32_t)pos;
+
+            // Read vertices and assemble triangles
+            if (draw.NumVertexPackets != 0) {
+                ReadCachedTriangles(draw, pos * 3, tri.Vertices);
             } else {
-                if (addedTriangles % VFloat::Length == 0) {
-                    TrianglePacket& newTri = batch.Alloc();
-                    assert(&newTri == (&tri + i / VFloat::Length + 1));
+                shader.ReadVtxFn(shader.State, pos * 3, tri.Vertices);
+            }
+
+            // Clip, setup, and bin
+            SetupTriangles(batch, clipper, shader.NumCustomAttribs, shader.Cull);
+        }
+    }
+}
+
+// Creates a task for each bin with triangles, or all of them if `allBins` is set, sorted heaviest first.
+// Bins that take a large share of all triangles are split into quadrants, which are rasterized independently.
+// Each pixel is still drawn by a single thread in submission order, so results don't depend on splitting.
+void Rasterizer::ScheduleBins(const BatchSet& batches, bool allBins) {
+    const uint32_t MinSplitTriangles = 64;
+    const TriangleBatch& first = *batches[0];
+    uint32_t binSize = 1u << first.BinSizeLog2;
+    uint64_t totalWeight = 0;
+    uint32_t totalChunks = 0, maxChunks = 0;
+
+    // Only bins that have triangles in some batch need to be visited, unless all of them must be finished.
+    _activeBins.clear();
+
+    if (allBins) {
+        _activeBins.resize(first.NumBins);
+        std::iota(_activeBins.begin(), _activeBins.end(), 0u);
+    } else {
+        for (const auto& batch : batches) {
+            _activeBins.insert(_activeBins.end(), &batch->ActiveBins[0], &batch->ActiveBins[batch->NumActiveBins]);
+        }
+        std::sort(_activeBins.begin(), _activeBins.end());
+        _activeBins.erase(std::unique(_activeBins.begin(), _activeBins.end()), _activeBins.end());
+    }
+
+    for (uint32_t binId : _activeBins) {
+        uint32_t weight = 0;
+
+        for (const auto& batch : batches) {
+            const TriangleBatch::BinList& bin = batch->Bins[binId];
+            weight += bin.NumTriangles;
+            totalChunks += bin.NumChunks;
+            maxChunks = std::max(maxChunks, bin.NumChunks);
+        }
+        _binTasks.push_back({
+            .BinId = binId,
+            .X = (binId % first.BinsPerRow) * binSize,
+            .Y = (binId / first.BinsPerRow) * binSize,
+            .Size = binSize,
+            .Weight = weight,
+        });
+        totalWeight += weight;
+    }
+    STAT_INCREMENT(BinChunks, totalChunks);
+    STAT_MAX(BinChunksMax, maxChunks);
+
+    uint32_t numThreads = ThreadPool::Shared().GetNumThreads();
+    size_t numBins = _binTasks.size();
+
+    for (size_t i = 0; i < numBins && numThreads > 1; i++) {
+        BinTask task = _binTasks[i];
+
+        // More than half of what each thread would get if the load was even
+        if (task.Weight < MinSplitTriangles || task.Weight * 2ull * numThreads < totalWeight) continue;
+
+        // Every quadrant walks the whole bin, but only rasterizes a quarter of it
+        task.Size /= 2;
+        task.Weight = task.Weight / 4 + 1;
+        _binTasks[i] = task;
+
+        for (uint32_t q = 1; q < 4; q++) {
+            BinTask quad = task;
+            quad.X += (q & 1) * task.Size;
+            quad.Y += (q >> 1) * task.Size;
+
+            if (quad.X < _fb->Width && quad.Y < _fb->Height) {
+                _binTasks.push_back(quad);
+            }
+        }
+    }
+    std::sort(_binTasks.begin(), _binTasks.end(), [](const BinTask& a, const BinTask& b) {
+        return a.Weight != b.Weight ? a.Weight > b.Weight : (a.Y != b.Y ? a.Y < b.Y : a.X < b.X);
+    });
+}
+
+// ParallelFor() gives each thread a contiguous range of indices to start with, before stealing from others.
+// Tasks are dealt to those ranges round-robin, so that every thread starts with setup and then the heaviest bins.
+void Rasterizer::ScheduleTasks(uint32_t numSetupTasks) {
+    const ThreadPool& pool = ThreadPool::Shared();
+    uint32_t numThreads = pool.GetNumThreads();
+    uint32_t numTasks = numSetupTasks + (uint32_t)_binTasks.size();
+
+    _taskOrder.resize(numTasks);
+
+    for (uint32_t task = 0, depth = 0; task < numTasks; depth++) {
+        for (uint32_t t = 0; t < numThreads && task < numTasks; t++) {
+            uint32_t pos = pool.GetRangeStart(numTasks, t) + depth;
+            if (pos < pool.GetRangeStart(numTasks, t + 1)) _taskOrder[pos] = task++;
+        }
+    }
+}
+
+void Rasterizer::RasterizeBin(BatchSet& batches, const BinTask& task) {
+    uint32_t numBatches = (uint32_t)batches.size();
+    uint32_t binId = task.BinId;
+
+    FragmentQueue queue;
+    uint32_t queueDrawId = 0;
+
+    BinnedTriangle bt = {
+        .X = task.X,
+        .Y = task.Y,
+        .Size = task.Size,
+        .Queue = &queue,
+    };
+    BinCursor cursors[MaxSetupThreads];
+
+    for (uint32_t i = 0; i < numBatches; i++) {
+        cursors[i] = { batches[i]->Bins[binId].Head, 0 };
+    }
+
+    // Entries in each batch are sorted by chunk, and chunks are unique to a batch. Drawing runs
+    // from the batch with the lowest chunk first gives back the original submission order.
+    while (true) {
+        uint32_t minChunk = UINT32_MAX, minBatch = 0;
+
+        for (uint32_t i = 0; i < numBatches; i++) {
+            const BinCursor& cursor = cursors[i];
+            if (cursor.Chunk == nullptr) continue;
+
+            uint32_t chunkId = batches[i]->ChunkIds[cursor.Chunk->Entries[cursor.Pos] / VFloat::Length];
+
+            if (chunkId < minChunk) {
+                minChunk = chunkId;
+                minBatch = i;
+            }
+        }
+        if (minChunk == UINT32_MAX) break;
+
+        TriangleBatch& batch = *batches[minBatch];
+        BinCursor& cursor = cursors[minBatch];
+
+        // All triangles of a chunk come from the same draw
+        uint32_t drawId = batch.DrawIds[cursor.Chunk->Entries[cursor.Pos] / VFloat::Length];
+        const ShaderInterface& shader = _draws[drawId].Shader;
+
+        if (queue.NumQuads != 0 && drawId != queueDrawId) {
+            const ShaderInterface& queueShader = _draws[queueDrawId].Shader;
+            queueShader.FlushFn(*this, queueShader.State, queue);
+        }
+        queueDrawId = drawId;
+        shader.DrawFn(*this, shader.State, bt, batch, cursor);
+    }
+    if (queue.NumQuads != 0) {
+        const ShaderInterface& queueShader = _draws[queueDrawId].Shader;
+        queueShader.FlushFn(*this, queueShader.State, queue);
+    }
+}
+
+void Rasterizer::SetupTriangles(TriangleBatch& batch, Clipper& clipper, uint32_t numCustomAttribs, CullMode cull) {
+    TrianglePacket& tri = batch.PeekLast();
+    Clipper::ClipCodes cc = clipper.ComputeClipCodes(tri);
+    uint32_t numAttribs = numCustomAttribs + 4;
+
+    VMask packetMasks[TriangleBatch::MaxPacketsPerInput] = { cc.AcceptMask };
+    uint32_t numPackets = 1;
+
+    if (cc.NonTrivialMask != 0) {
+        clipper.ClipTriangles(tri, cc, numAttribs);
+
+        // Triangulate result polygons. The first triangle of each fan replaces its source, others are packed
+        // into the free lanes of the source packet, then into new packets.
+        VMask clippedMask = cc.NonTrivialMask & (clipper.Count >= 3);
+        clipper.StoreTriangles(tri, 0, VInt::ramp(), clippedMask, numAttribs);
+        packetMasks[0] |= clippedMask;
+
+        for (uint32_t i = 1; i + 2 < clipper.MaxCount; i++) {
+            VMask fanMask = cc.NonTrivialMask & (clipper.Count > (int32_t)i + 2);
+
+            while (fanMask != 0) {
+                if (packetMasks[numPackets - 1] == 0xFFFF) {
+                    batch.Alloc();
+                    packetMasks[numPackets++] = 0;
+                }
+                VMask freeMask = (VMask)~packetMasks[numPackets - 1];
+                alignas(64) int32_t srcLanes[VInt::Length] = {};
+                VMask storeMask = 0;
+
+                for (uint32_t j : BitIter(freeMask)) {
+                    if (fanMask == 0) break;
+
+                    srcLanes[j] = (int32_t)std::countr_zero(fanMask);
+                    storeMask |= 1u << j;
+                    fanMask &= fanMask - 1;
                 }
-                _clipper.StoreTriangle(batch.PeekLast(), addedTriangles % VFloat::Length, j, numAttribs);
-                addedTriangles++;
+                TrianglePacket& dest = *(&tri + numPackets - 1);
+                VInt srcLaneIds = VInt::load(srcLanes);
+                clipper.StoreTriangles(dest, i, srcLaneIds, storeMask, numAttribs);
+                dest.PrimitiveId = simd::csel(storeMask, simd::permute(tri.PrimitiveId, srcLaneIds), dest.PrimitiveId);
+                packetMasks[numPackets - 1] |= storeMask;
             }
         }
-        STAT_INCREMENT(TrianglesClipped, 1);
+        STAT_INCREMENT(TrianglesClipped, (uint32_t)std::popcount(clippedMask));
     }
 
-    if (cc.AcceptMask == 0 && addedTriangles == 0) {
+    if (packetMasks[0] == 0 && numPackets == 1) {
         batch.Count--;  // free unused triangle
         return;
     }
 
-    if (cc.AcceptMask != 0) {
-        BinTriangles(batch, tri, cc.AcceptMask, numCustomAttribs);
-    }
-
-    for (uint32_t i = 0; i < addedTriangles; i += VFloat::Length) {
-        uint16_t mask = (1u << std::min(VFloat::Length, addedTriangles - i)) - 1;
-        BinTriangles(batch, *(&tri + i / VFloat::Length + 1), mask, numCustomAttribs);
+    for (uint32_t i = 0; i < numPackets; i++) {
+        BinTriangles(batch, *(&tri + i), packetMasks[i], numCustomAttribs, cull);
     }
 }
 
-void Rasterizer::BinTriangles(TriangleBatch& batch, TrianglePacket& tris, VMask mask, uint32_t numAttribs) {
+void Rasterizer::BinTriangles(TriangleBatch& batch, TrianglePacket& tris, VMask mask, uint32_t numAttribs, CullMode cull) {
     int32_t width = (int32_t)_fb->Width, height = (int32_t)_fb->Height;
-    tris.Setup(width, height, numAttribs);
-
-    mask &= tris.RcpArea > 0.0f;  // backface culling (skip triangles with negative area)
+    mask &= tris.Setup(width, height, numAttribs, cull);
     mask &= tris.RcpArea < 1.0f;  // skip triangles with zero area
 
+    uint32_t binsFilled = 0;
+
     for (uint32_t i : BitIter(mask)) {
-        const uint32_t binShift = TriangleBatch::BinSizeLog2;
+        const uint32_t binShift = batch.BinSizeLog2;
 
         uint32_t minX = (uint32_t)tris.MinX[i] >> binShift;
         uint32_t minY = (uint32_t)tris.MinY[i] >> binShift;
@@ -135,10 +466,11 @@ void Rasterizer::BinTriangles(TriangleBatch& batch, TrianglePacket& tris, VMask
         for (uint32_t y = minY; y <= maxY; y++) {
             for (uint32_t x = minX; x <= maxX; x++) {
                 batch.AddBin(x, y, tris, i);
-                STAT_INCREMENT(BinsFilled, 1);
             }
         }
+        binsFilled += (maxX - minX + 1) * (maxY - minY + 1);
     }
+    STAT_INCREMENT(BinsFilled, binsFilled);
     STAT_INCREMENT(TrianglesDrawn, (uint32_t)std::popcount(mask));
 }
 
@@ -150,59 +482,109 @@ static std::array<VInt, 3> LoadFixedPos(const TrianglePacket& tri, uint32_t axis
     };
 };
 
-static VInt ComputeMinBB(VInt a, VInt b, VInt c, int32_t vpSize) {
+static VInt ComputeMinBB(VInt a, VInt b, VInt c, int32_t vpSize, uint32_t subpixelBits) {
     VInt r = simd::min(simd::min(a, b), c);
-    r = (r + 15) >> 4;                                        // round up to int
-    r = r & ~(int32_t)Framebuffer::TileMask;                  // align min bb coords to tile boundary
+    r = (r + ((1 << subpixelBits) - 1)) >> subpixelBits;     // round up to int
     r = simd::min(simd::max(r + vpSize, 0), vpSize * 2 - 4);  // translate to 0,0 origin and clamp to vp size
+    // Align to tile boundary after translating, since the viewport center is not on one if the size isn't a multiple of 8
+    r = r & ~(int32_t)Framebuffer::TileMask;
     return r;
 }
-static VInt ComputeMaxBB(VInt a, VInt b, VInt c, int32_t vpSize) {
+static VInt ComputeMaxBB(VInt a, VInt b, VInt c, int32_t vpSize, uint32_t subpixelBits) {
     VInt r = simd::max(simd::max(a, b), c);
-    r = (r + 15) >> 4;                                        // round up to int
+    r = (r + ((1 << subpixelBits) - 1)) >> subpixelBits;     // round up to int
     r = simd::min(simd::max(r + vpSize, 0), vpSize * 2 - 4);  // translate to 0,0 origin and clamp to vp size
     return r;
 }
 
-static VInt ComputeEdge(VInt a, VInt x, VInt b, VInt y) {
-    VInt w = a * x + b * y;
+// Computes `(a * x + b * y + bias) >> subpixelBits`. The products of whole and fractional parts of x and y
+// are shifted separately, so that only the result needs to fit in 32 bits, not the full-precision products.
+static VInt ComputeEdge(VInt a, VInt x, VInt b, VInt y, uint32_t subpixelBits) {
+    VInt fracMask = (1 << subpixelBits) - 1;
+    VInt w = a * (x >> subpixelBits) + b * (y >> subpixelBits);
+    VInt frac = a * (x & fracMask) + b * (y & fracMask);
     // Add top-left rule bias (I don't even know if this is doing anything tbh)
     //  w += (a > 0 || (a == 0 && b > 0)) ? 0 : -1
-    w += simd::csel(a > 0 | (a == 0 & b > 0), 0, VInt(-1));
-    return w >> 4;
+    frac += simd::csel(a > 0 | (a == 0 & b > 0), 0, VInt(-1));
+    return w + (frac >> subpixelBits);
 }
 
 // https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
 // This is missing handling on a few subtleties listed in the article:
-//  - Overflow: work-able region is only 2048x2048, but could be extended to 8192x8192
 //  - Top-left bias: vertex attributes will be interpolated with some slight shift
-void TrianglePacket::Setup(int32_t vpWidth, int32_t vpHeight, uint32_t numAttribs) {
+VMask TrianglePacket::Setup(int32_t vpWidth, int32_t vpHeight, uint32_t numAttribs, CullMode cull) {
     // Perspective division
     for (uint32_t i = 0; i < 3; i++) {
         VFloat4& pos = Vertices[i].Position;
         pos = simd::PerspectiveDiv(pos);
     }
 
+    uint32_t subpixelBits = GetSubpixelBits((uint32_t)std::max(vpWidth, vpHeight));
+    float subpixelScale = (float)(1 << subpixelBits);
+
     vpWidth /= 2, vpHeight /= 2;
 
-    auto [x0, x1, x2] = LoadFixedPos(*this, 0, vpWidth * 16.0f);
-    MinX = ComputeMinBB(x0, x1, x2, vpWidth);
-    MaxX = ComputeMaxBB(x0, x1, x2, vpWidth);
+    auto [x0, x1, x2] = LoadFixedPos(*this, 0, vpWidth * subpixelScale);
+    MinX = ComputeMinBB(x0, x1, x2, vpWidth, subpixelBits);
+    MaxX = ComputeMaxBB(x0, x1, x2, vpWidth, subpixelBits);
 
-    auto [y0, y1, y2] = LoadFixedPos(*this, 1, vpHeight * 16.0f);
-    MinY = ComputeMinBB(y0, y1, y2, vpHeight);
-    MaxY = ComputeMaxBB(y0, y1, y2, vpHeight);
+    auto [y0, y1, y2] = LoadFixedPos(*this, 1, vpHeight * subpixelScale);
+    MinY = ComputeMinBB(y0, y1, y2, vpHeight, subpixelBits);
+    MaxY = ComputeMaxBB(y0, y1, y2, vpHeight, subpixelBits);
 
     A01 = y0 - y1, B01 = x1 - x0;
     A12 = y1 - y2, B12 = x2 - x1;
     A20 = y2 - y0, B20 = x0 - x2;
 
-    auto minX = (MinX - vpWidth) << 4, minY = (MinY - vpHeight) << 4;
-    Weight0 = ComputeEdge(A12, minX - x1, B12, minY - y1);
-    Weight1 = ComputeEdge(A20, minX - x2, B20, minY - y2);
-    Weight2 = ComputeEdge(A01, minX - x0, B01, minY - y0);
-
-    RcpArea = 16.0f / simd::conv2f(B01 * A20 - B20 * A01);
+    // Twice the triangle area is the first edge function at the opposite vertex. It doesn't fit in 32 bits
+    // for large triangles, so it is combined from the whole and fractional parts.
+    VInt fracMask = (1 << subpixelBits) - 1;
+    VInt areaFrac = A12 * ((x0 - x1) & fracMask) + B12 * ((y0 - y1) & fracMask);
+    VInt areaInt = A12 * ((x0 - x1) >> subpixelBits) + B12 * ((y0 - y1) >> subpixelBits) + (areaFrac >> subpixelBits);
+    VFloat area = simd::conv2f(areaInt) * subpixelScale + simd::conv2f(areaFrac & fracMask);
+
+    // Edge functions are negative inside clockwise triangles. Those that are not culled are flipped by negating
+    // the edges, which gives the same barycentrics once the area is negated too.
+    VMask cullMask = 0;
+    if (cull == CullMode::Back) cullMask = area <= 0.0f;
+    if (cull == CullMode::Front) cullMask = area >= 0.0f;
+    VMask flipMask = area < 0.0f;
+
+    if (cull != CullMode::Back && flipMask) {
+        VInt* edges[] = { &A01, &A12, &A20, &B01, &B12, &B20 };
+
+        for (VInt* edge : edges) {
+            *edge = simd::csel(flipMask, 0 - *edge, *edge);
+        }
+        area = simd::csel(flipMask, -area, area);
+    }
+    RcpArea = subpixelScale / area;
+
+    auto minX = (MinX - vpWidth) << subpixelBits, minY = (MinY - vpHeight) << subpixelBits;
+    Weight0 = ComputeEdge(A12, minX - x1, B12, minY - y1, subpixelBits);
+    Weight1 = ComputeEdge(A20, minX - x2, B20, minY - y2, subpixelBits);
+    Weight2 = ComputeEdge(A01, minX - x0, B01, minY - y0, subpixelBits);
+
+    // Small triangles often fall between pixel centers. Those that have no sample in their bounds, or a
+    // single one which is outside an edge, are culled here instead of going through binning and rasterization.
+    VInt sampleMinX = (simd::min(simd::min(x0, x1), x2) + fracMask) >> subpixelBits;
+    VInt sampleMaxX = simd::max(simd::max(x0, x1), x2) >> subpixelBits;
+    VInt sampleMinY = (simd::min(simd::min(y0, y1), y2) + fracMask) >> subpixelBits;
+    VInt sampleMaxY = simd::max(simd::max(y0, y1), y2) >> subpixelBits;
+
+    VMask visibleMask = ~cullMask & (sampleMinX <= sampleMaxX) & (sampleMinY <= sampleMaxY);
+    visibleMask &= (sampleMinX < vpWidth) & (sampleMaxX >= -vpWidth);
+    visibleMask &= (sampleMinY < vpHeight) & (sampleMaxY >= -vpHeight);
+
+    VMask singleSampleMask = visibleMask & (sampleMinX == sampleMaxX) & (sampleMinY == sampleMaxY);
+
+    if (singleSampleMask) {
+        VInt offsX = sampleMinX + vpWidth - MinX, offsY = sampleMinY + vpHeight - MinY;
+        VInt w0 = Weight0 + A12 * offsX + B12 * offsY;
+        VInt w1 = Weight1 + A20 * offsX + B20 * offsY;
+        VInt w2 = Weight2 + A01 * offsX + B01 * offsY;
+        visibleMask &= ~(singleSampleMask & ((w0 | w1 | w2) < 0));
+    }
 
     // Prepare attributes for interpolation
     for (uint32_t i = 0; i <= numAttribs; i++) {
@@ -212,25 +594,7 @@ void TrianglePacket::Setup(int32_t vpWidth, int32_t vpHeight, uint32_t numAttrib
         Vertices[1].Attribs[j] -= v0;
         Vertices[2].Attribs[j] -= v0;
     }
-}
-
-void Framebuffer::IterateTiles(std::function<void(uint32_t, uint32_t)> visitor, uint32_t downscaleFactor) {
-    downscaleFactor *= 4;
-
-    auto range = std::ranges::iota_view(0u, Height / downscaleFactor);
-
-    std::for_each(std::execution::par_unseq, range.begin(), range.end(), [&](uint32_t y) {
-        for (uint32_t x = 0; x < Width; x += downscaleFactor) {
-            visitor(x, y * downscaleFactor);
-        }
-    });
-}
-
-ProfilerStats g_Stats = {};
-
-uint64_t ProfilerStats::CurrentTime() {
-    auto time = std::chrono::high_resolution_clock::now();
-    return (uint64_t)time.time_since_epoch().count();
+    return visibleMask;
 }
 
 };  // namespace swr
@@ -2,27 +2,29 @@
 
 #include "SwRast.h"
 #include "Texture.h"
+#include "ThreadPool.h"
+#include <algorithm>
 #include <random>
 
-namespace renderer {
+namespace renderer::inline SWR_ISA_NS {
 
 using swr::VInt, swr::VFloat, swr::VFloat2, swr::VFloat3, swr::VFloat4, swr::VMask;
 using namespace swr::simd;
 
 enum class DebugLayer { None, BaseColor, Normals, MetallicRoughness, Occlusion, EmissiveMask, Overdraw };
 
-// Deferred PBR shader
+// Deferred PBR shader, lighting pass. Geometry is drawn into the G-Buffer with `SurfaceShader`.
 // https://google.github.io/filament/Filament.html
 // https://bruop.github.io/ibl/
 struct DefaultShader {
-    static const uint32_t NumCustomAttribs = 8, NumFbAttachments = 9;
-
-    static constexpr swr::SamplerDesc SurfaceSampler = {
-        .Wrap = swr::WrapMode::Repeat,
-        .MagFilter = swr::FilterMode::Linear,
-        .MinFilter = swr::FilterMode::Nearest,  // Downsample with nearest for better perf, quality loss is quite subtle.
-        .EnableMips = true,
+    // G-Buffer attachments, in addition to the color (#1) and depth buffers. See `SurfaceShader` for the layout.
+    static const uint32_t FbNormalsId = 0, FbEmissiveId = 1, FbOcclusionId = 2;
+    static constexpr swr::Framebuffer::AttachmentDesc FbAttachments[] = {
+        { .BytesPerPixel = 4 },                  // #2, also holds the reprojected color during TAA
+        { .BytesPerPixel = 4 },                  // #3
+        { .BytesPerPixel = 1, .ScaleLog2 = 1 },  // SSAO
     };
+
     static constexpr swr::SamplerDesc EnvSampler = {
         .Wrap = swr::WrapMode::ClampToEdge,
         .MagFilter = swr::FilterMode::Linear,
@@ -42,11 +44,8 @@ struct DefaultShader {
     std::unique_ptr<swr::Framebuffer> PrevFrame;
     swr::AlignedBuffer<uint32_t> ResolvedTAABuffer;
 
-    // Uniform: Forward
-    glm::mat4 ProjMat, ModelMat;
-    const swr::RgbaTexture2D* MaterialTex;  // See `scene::Material` for what's on this texture.
-
     // Uniform: Compose pass
+    glm::mat4 ProjMat;
     const swr::Framebuffer* ShadowBuffer;
     glm::mat4 ShadowProjMat, ViewMat;
     glm::vec3 LightPos, ViewPos;
@@ -56,241 +55,47 @@ struct DefaultShader {
     bool EnableTAA = true;
     bool BlurSkybox = false;
 
-    void ShadeVertices(const swr::VertexReader& data, swr::ShadedVertexPacket& vars) const {
-        VFloat3 pos = data.ReadAttribs<VFloat3>(&scene::Vertex::x);
-        vars.Position = TransformVector(ProjMat, { pos, 1.0f });
-
-        vars.SetAttribs(0, data.ReadAttribs<VFloat2>(&scene::Vertex::u));
-
-        VFloat3 norm = data.ReadAttribs<VFloat3>(&scene::Vertex::nx);
-        vars.SetAttribs(2, TransformNormal(ModelMat, norm));
-
-        VFloat3 tang = data.ReadAttribs<VFloat3>(&scene::Vertex::tx);
-        vars.SetAttribs(5, TransformNormal(ModelMat, tang));
-    }
-
-    void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {
-        vars.ApplyPerspectiveCorrection();
-
-        VFloat u = vars.GetSmooth(0);
-        VFloat v = vars.GetSmooth(1);
-
-        VInt baseColor = MaterialTex->Sample<SurfaceSampler>(u, v, 0);
-        VFloat3 N = normalize(vars.GetSmooth<VFloat3>(2));
-
-        VFloat metalness = 0.0f;
-        VFloat roughness = 0.5f;
-
-        if (MaterialTex->NumLayers >= 2) [[likely]] {
-            VFloat4 SN = UnpackRGBA(MaterialTex->Sample<SurfaceSampler>(u, v, 1));
-            VFloat3 T = vars.GetSmooth<VFloat3>(5);
-
-            // Gram-schmidt process (produces higher-quality normal mapping on large meshes)
-            // Re-orthogonalize T with respect to N
-            T = normalize(T - dot(T, N) * N);
-            VFloat3 B = cross(N, T);
-
-            // Flip bitangent depending on whether UVs are mirrored - https://stackoverflow.com/a/44901073
-            // TODO: maybe cheaper to compute tangents using screen derivatives all the way. (maybe too blocky?)
-            VFloat det = (dFdy(u) * dFdx(v) - dFdx(u) * dFdy(v)) & -0.0f;
-            B = { B.x ^ det, B.y ^ det, B.z ^ det };  // det < 0 ? -B : B
-
-            // Reconstruct Z from 2-channel normap map
-            // https://aras-p.info/texts/CompactNormalStorage.html
-            // https://www.researchgate.net/publication/259000109_Real-Time_Normal_Map_DXT_Compression
-            // This isn't exact due to interpolation and mipmapping, but it's quite subtle after texturing anyway.
-            VFloat Sx = SN.x * 2.0f - 1.0f;
-            VFloat Sy = SN.y * 2.0f - 1.0f;
-            VFloat Sz = sqrt14(1.0f - (Sx * Sx + Sy * Sy));
-
-            N.x = T.x * Sx + B.x * Sy + N.x * Sz;
-            N.y = T.y * Sx + B.y * Sy + N.y * Sz;
-            N.z = T.z * Sx + B.z * Sy + N.z * Sz;
-
-            metalness = SN.z;
-            roughness = SN.w;
-        }
-        // G-Buffer channels
-        //               LSB 0  ...  31 MSB
-        //   #1 [24: BaseColor] [8: Metalness]
-        //   #2 [1: NormalSign] [1: HasEmissive] [10: Roughness] [20: EncNormal]
-        //   #3 [8: Unused] [24: EmissiveColor]
-        VInt alpha = shrl(baseColor, 24);
-        vars.TileMask &= alpha >= 128;  // alpha test
-
-        bool hasEmissive = MaterialTex->NumLayers >= 3 && any(alpha == 255);
-
-        if (hasEmissive) [[unlikely]] {
-            VInt emissiveColor = MaterialTex->Sample<SurfaceSampler>(u, v, 2);
-            _mm512_mask_store_epi32(fb.GetAttachmentBuffer<uint32_t>(4, vars.TileOffset), vars.TileMask, emissiveColor);
-        }
-
-        VInt G1 = (baseColor & 0xFFFFFF) | round2i(metalness * 255.0f) << 24;
-        fb.WriteTile(vars.TileOffset, vars.TileMask, G1, vars.Depth);
-
-        VInt G2 = SignedOctEncode(N, roughness) | (hasEmissive ? 2 : 0);
-        _mm512_mask_store_epi32(fb.GetAttachmentBuffer<uint32_t>(0, vars.TileOffset), vars.TileMask, G2);
-    }
-
     void Compose(swr::Framebuffer& fb, bool hasSSAO, swr::Framebuffer& prevFb) {
-        glm::mat4 invProj = glm::inverse(ProjMat);
-        // Bias matrix to take UVs in range [0..screen] rather than [-1..1]
-        invProj = glm::translate(invProj, glm::vec3(-1.0f, -1.0f, 0.0f));
-        invProj = glm::scale(invProj, glm::vec3(2.0f / fb.Width, 2.0f / fb.Height, 1.0f));
-
-        fb.IterateTiles([&](uint32_t x, uint32_t y) {
-            uint32_t tileOffset = fb.GetPixelOffset(x, y);
-            VFloat tileDepth = VFloat::load(&fb.DepthBuffer[tileOffset]);
-            VMask skyMask = tileDepth >= 1.0f;
-
-            VInt tileX = (int32_t)x + swr::FragPixelOffsetsX;
-            VInt tileY = (int32_t)y + swr::FragPixelOffsetsY;
-            VFloat3 worldPos = VFloat3(PerspectiveDiv(TransformVector(invProj, { conv2f(tileX), conv2f(tileY), tileDepth, 1.0f })));
-
-            VFloat3 finalColor;
-
-            if (!all(skyMask)) {
-                // Unpack G-Buffer
-                VFloat4 G1 = UnpackRGBA(VInt::load(&fb.ColorBuffer[tileOffset]));
-                VInt G2r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(0, tileOffset));
-                VMask emissiveMask = (G2r & 2) != 0;
-                VFloat4 G2 = SignedOctDecode(G2r);
+        glm::mat4 invProj = GetScreenToWorldMat(fb);
 
-                VFloat3 baseColor = SrgbToLinear(VFloat3(G1));
-                VFloat3 N = VFloat3(G2);
-                VFloat metalness = G1.w;
-
-                VFloat perceptualRoughness = max(G2.w, 0.045f);  // clamp to prevent div by zero
-                VFloat roughness = perceptualRoughness * perceptualRoughness;
-
-                // Microfacet BRDF
-                VFloat3 V = normalize(ViewPos - worldPos);
-                VFloat3 L = normalize(LightPos);
-                VFloat3 H = normalize(V + L);
-
-                VFloat NoV = max(dot(N, V), 1e-4f);
-                VFloat NoL = max(dot(N, L), 0.0f);
-                VFloat NoH = max(dot(N, H), 0.0f);
-                VFloat LoH = max(dot(L, H), 0.0f);
-
-                float reflectance = 0.5f;
-
-                VFloat D = D_GGX(NoH, roughness);
-                VFloat G = V_SmithGGXCorrelatedFast(NoV, NoL, roughness);
-                VFloat3 f0 = (0.16f * reflectance * reflectance) * (1.0f - metalness) + baseColor * metalness;
-                VFloat3 F = F_Schlick(LoH, f0);
-
-                // specular
-                VFloat3 Fr = D * G * F;
-
-                // diffuse
-                VFloat3 diffuseColor = (1.0f - metalness) * VFloat3(baseColor);
-                VFloat3 Fd = (1.0f - F) * diffuseColor * Fd_Lambert();
-
-                if (ShadowBuffer != nullptr && any(NoL > 0.0f)) {
-                    [[clang::always_inline]] NoL *= GetShadow(worldPos, NoL);
-                }
-                finalColor = (Fd + Fr) * NoL;
-
-                if (IntensityIBL > 0.0f && SkyboxTex != nullptr) {
-                    VFloat3 R = reflect(0 - V, N);
-                    VFloat3 irradiance = IrradianceMap->SampleCube<EnvSampler>(R);
-                    VFloat3 radiance = FilteredEnvMap->SampleCube<EnvSampler>(R, perceptualRoughness * (int32_t)FilteredEnvMap->MipLevels);
-                    VFloat2 dfg = BRDFEnvLut.Sample<EnvSampler>(NoV, perceptualRoughness);
-                    VFloat3 specularColor = f0 * dfg.x + dfg.y;
-                    VFloat3 ibl = irradiance * diffuseColor + radiance * specularColor;
-
-                    // TODO: multi-scatter IBL
-
-                    //if (hasSSAO) {
-                    //    ibl = ibl * GetAO(fb, x, y);
-                    //}
-                    finalColor = finalColor + ibl * IntensityIBL;
-                }
-
-                // This is technically not PBR but if we add AO to IBL it will never be intense enough.
-                // (though it's not like anything here is strictly correct anyway...)
-                if (hasSSAO) {
-                    finalColor = finalColor * GetAO(fb, x, y);
-                }
-
-                // Emissive color
-                if (any(emissiveMask)) {
-                    VInt G3r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(4, tileOffset));
-                    G3r = csel(emissiveMask, G3r, 0);
-
-                    VFloat3 emissiveColor = VFloat3(UnpackRGBA(G3r));
-                    finalColor = finalColor + SrgbToLinear(emissiveColor);
-                }
-            }
-
-            if (any(skyMask) && SkyboxTex != nullptr) {
-                auto& envTex = BlurSkybox ? FilteredEnvMap : SkyboxTex;
-                VFloat3 skyColor = envTex->SampleCube<EnvSampler>(worldPos - ViewPos, 1);
-
-                finalColor.x = csel(skyMask, skyColor.x, finalColor.x);
-                finalColor.y = csel(skyMask, skyColor.y, finalColor.y);
-                finalColor.z = csel(skyMask, skyColor.z, finalColor.z);
-            }
-
-            finalColor = Tonemap_Unreal(finalColor * Exposure);
-
-            VInt packedColor = PackRGBA({ finalColor, 1.0f });
-            packedColor.store(&fb.ColorBuffer[tileOffset]);
-
-            if (EnableTAA && FrameNo != 0) {
-                VFloat4 prevNDC = PerspectiveDiv(TransformVector(PrevProjMat, { VFloat3(worldPos), 1.0f }));
-                prevNDC.x -= Jitter.x;
-                prevNDC.y -= Jitter.y;
-                prevNDC = prevNDC * 0.5 + 0.5;
-
-                VInt prevX = round2i(prevNDC.x * fb.Width);
-                VInt prevY = round2i(prevNDC.y * fb.Height);
-
-                // Save prevColor to avoid having to recompute worldDepth on the TAA pass
-                VInt prevColor = PrevFrame->SampleColor(prevX, prevY, packedColor);
-                prevColor.store(fb.GetAttachmentBuffer<int32_t>(0, tileOffset));
-            }
-        });
+        fb.IterateTiles([&](uint32_t x, uint32_t y) { ComposeTile(fb, invProj, x, y, hasSSAO); });
 
         // Temporal Anti-Alias
         // - https://www.elopezr.com/temporal-aa-and-the-quest-for-the-holy-trail/
         // - https://alextardif.com/TAA.html
         // - https://sugulee.wordpress.com/2021/06/21/temporal-anti-aliasingtaa-tutorial/
-        // 
-        // TODO: it might be possible to work in tiles rather than on the entire fb to improve cache-ability
         if (EnableTAA && FrameNo > 0) {
-            fb.IterateTiles([&](uint32_t x, uint32_t y) {
-                uint32_t tileOffset = fb.GetPixelOffset(x, y);
-                VInt currColor = VInt::load(&fb.ColorBuffer[tileOffset]);
-                VInt prevColor = VInt::load(fb.GetAttachmentBuffer<int32_t>(0, tileOffset));
-
-                VInt minColor = (int32_t)0xFFFF'FFFF, maxColor = 0;
-                VInt tileX = (int32_t)x + swr::FragPixelOffsetsX;
-                VInt tileY = (int32_t)y + swr::FragPixelOffsetsY;
-
-                // Sample a 3x3 neighborhood to create a box in color space
-                for (int32_t xo = -1; xo <= 1; xo++) {
-                    for (int32_t yo = -1; yo <= 1; yo++) {
-                        VInt color = fb.SampleColor(tileX + xo, tileY + yo, currColor);
-                        minColor = _mm512_min_epu8(minColor, color);
-                        maxColor = _mm512_max_epu8(maxColor, color);
-                    }
-                }
-                prevColor = _mm512_min_epu8(_mm512_max_epu8(prevColor, minColor), maxColor);
-
-                //VFloat3 currColorF = VFloat3(UnpackRGBA(currColor));
-                //VFloat3 prevColorF = VFloat3(UnpackRGBA(prevColor));
-                //VFloat3 resolvedColor = prevColorF + (currColorF - prevColorF) * 0.1f;
-                //VInt finalColor = PackRGBA({ resolvedColor, 1.0f });
+            glm::uvec4 bounds = { 0, 0, fb.Width, fb.Height };
+            fb.IterateTiles([&](uint32_t x, uint32_t y) { ResolveTAATile(fb, x, y, bounds); });
+        }
+        EndCompose(fb);
+    }
 
-                // Fixed-point is a smidge faster
-                VInt alpha = _mm512_set1_epi16(0.1f * ((1 << 15) - 1));
-                VInt finalColor = lerp16((prevColor >> 0) & 0x00FF'00FF, (currColor >> 0) & 0x00FF'00FF, alpha) |
-                                  lerp16((prevColor >> 8) & 0x00FF'00FF, (currColor >> 8) & 0x00FF'00FF, alpha) << 8;
+    // Same as Compose() for a single region, meant to be fused with rasterization through the callback of
+    // `Rasterizer::Flush()` while the G-Buffer is still in cache. Regions must be aligned to tiles and can be
+    // composed in parallel. EndCompose() must be called once all of them are done.
+    // SSAO is not supported since it needs the full depth buffer, and the TAA neighborhood is clamped to
+    // the region, which makes color clipping slightly looser along its borders.
+    void ComposeRegion(swr::Framebuffer& fb, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        glm::mat4 invProj = GetScreenToWorldMat(fb);
+        glm::uvec4 bounds = { x, y, x + width, y + height };
+
+        for (uint32_t ty = bounds.y; ty < bounds.w; ty += swr::Framebuffer::TileSize) {
+            for (uint32_t tx = bounds.x; tx < bounds.z; tx += swr::Framebuffer::TileSize) {
+                ComposeTile(fb, invProj, tx, ty, false);
+            }
+        }
+        if (EnableTAA && FrameNo > 0) {
+            for (uint32_t ty = bounds.y; ty < bounds.w; ty += swr::Framebuffer::TileSize) {
+                for (uint32_t tx = bounds.x; tx < bounds.z; tx += swr::Framebuffer::TileSize) {
+                    ResolveTAATile(fb, tx, ty, bounds);
+                }
+            }
+        }
+    }
 
-                finalColor.store(&ResolvedTAABuffer[tileOffset]);
-            });
+    void EndCompose(swr::Framebuffer& fb) {
+        if (EnableTAA && FrameNo > 0) {
             std::swap(fb.ColorBuffer, ResolvedTAABuffer);
         }
         FrameNo++;
@@ -308,7 +113,8 @@ struct DefaultShader {
         if (PrevFrame == nullptr || fb.Width != PrevFrame->Width || fb.Height != PrevFrame->Height) {
             PrevFrame = std::make_unique<swr::Framebuffer>(fb.Width, fb.Height);
             PrevFrame->DepthBuffer = nullptr; // save memory we shouldn't have allocated in the first place.
-            ResolvedTAABuffer = swr::alloc_buffer<uint32_t>(fb.Width * fb.Height);
+            PrevFrame->CoarseDepthBuffer = nullptr;
+            ResolvedTAABuffer = swr::alloc_buffer<uint32_t>(fb.BufferSize, swr::MemoryUsage::Framebuffer);
             FrameNo = 0;
         }
         std::swap(fb.ColorBuffer, PrevFrame->ColorBuffer);
@@ -329,7 +135,7 @@ struct DefaultShader {
             VFloat3 finalColor = 0.0f;
 
             VFloat4 G1 = UnpackRGBA(VInt::load(&fb.ColorBuffer[tileOffset]));
-            VInt G2r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(0, tileOffset));
+            VInt G2r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(FbNormalsId, tileOffset));
             VFloat4 G2 = SignedOctDecode(G2r);
 
             if (layer == DebugLayer::BaseColor) {
@@ -352,6 +158,169 @@ struct DefaultShader {
     }
 
 private:
+    glm::mat4 GetScreenToWorldMat(swr::Framebuffer& fb) {
+        glm::mat4 invProj = glm::inverse(ProjMat);
+        // Bias matrix to take UVs in range [0..screen] rather than [-1..1]
+        invProj = glm::translate(invProj, glm::vec3(-1.0f, -1.0f, 0.0f));
+        invProj = glm::scale(invProj, glm::vec3(2.0f / fb.Width, 2.0f / fb.Height, 1.0f));
+        return invProj;
+    }
+
+    void ComposeTile(swr::Framebuffer& fb, const glm::mat4& invProj, uint32_t x, uint32_t y, bool hasSSAO) {
+        uint32_t tileOffset = fb.GetPixelOffset(x, y);
+        VFloat tileDepth = VFloat::load(&fb.DepthBuffer[tileOffset]);
+        VMask skyMask = tileDepth >= 1.0f;
+
+        VInt tileX = (int32_t)x + swr::FragPixelOffsetsX();
+        VInt tileY = (int32_t)y + swr::FragPixelOffsetsY();
+        VFloat3 worldPos = VFloat3(PerspectiveDiv(TransformVector(invProj, { conv2f(tileX), conv2f(tileY), tileDepth, 1.0f })));
+
+        VFloat3 finalColor;
+
+        if (!all(skyMask)) {
+            // Unpack G-Buffer
+            VFloat4 G1 = UnpackRGBA(VInt::load(&fb.ColorBuffer[tileOffset]));
+            VInt G2r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(FbNormalsId, tileOffset));
+            VMask emissiveMask = (G2r & 2) != 0;
+            VFloat4 G2 = SignedOctDecode(G2r);
+
+            VFloat3 baseColor = SrgbToLinear(VFloat3(G1));
+            VFloat3 N = VFloat3(G2);
+            VFloat metalness = G1.w;
+
+            VFloat perceptualRoughness = max(G2.w, 0.045f);  // clamp to prevent div by zero
+            VFloat roughness = perceptualRoughness * perceptualRoughness;
+
+            // Microfacet BRDF
+            VFloat3 V = normalize(ViewPos - worldPos);
+            VFloat3 L = normalize(LightPos);
+            VFloat3 H = normalize(V + L);
+
+            VFloat NoV = max(dot(N, V), 1e-4f);
+            VFloat NoL = max(dot(N, L), 0.0f);
+            VFloat NoH = max(dot(N, H), 0.0f);
+            VFloat LoH = max(dot(L, H), 0.0f);
+
+            float reflectance = 0.5f;
+
+            VFloat D = D_GGX(NoH, roughness);
+            VFloat G = V_SmithGGXCorrelatedFast(NoV, NoL, roughness);
+            VFloat3 f0 = (0.16f * reflectance * reflectance) * (1.0f - metalness) + baseColor * metalness;
+            VFloat3 F = F_Schlick(LoH, f0);
+
+            // specular
+            VFloat3 Fr = D * G * F;
+
+            // diffuse
+            VFloat3 diffuseColor = (1.0f - metalness) * VFloat3(baseColor);
+            VFloat3 Fd = (1.0f - F) * diffuseColor * Fd_Lambert();
+
+            if (ShadowBuffer != nullptr && any(NoL > 0.0f)) {
+                [[clang::always_inline]] NoL *= GetShadow(worldPos, NoL);
+            }
+            finalColor = (Fd + Fr) * NoL;
+
+            if (IntensityIBL > 0.0f && SkyboxTex != nullptr) {
+                VFloat3 R = reflect(0 - V, N);
+                VFloat3 irradiance = IrradianceMap->SampleCube<EnvSampler>(R);
+                VFloat3 radiance = FilteredEnvMap->SampleCube<EnvSampler>(R, perceptualRoughness * (int32_t)FilteredEnvMap->MipLevels);
+                VFloat2 dfg = BRDFEnvLut.Sample<EnvSampler>(NoV, perceptualRoughness);
+                VFloat3 specularColor = f0 * dfg.x + dfg.y;
+                VFloat3 ibl = irradiance * diffuseColor + radiance * specularColor;
+
+                // TODO: multi-scatter IBL
+
+                //if (hasSSAO) {
+                //    ibl = ibl * GetAO(fb, x, y);
+                //}
+                finalColor = finalColor + ibl * IntensityIBL;
+            }
+
+            // This is technically not PBR but if we add AO to IBL it will never be intense enough.
+            // (though it's not like anything here is strictly correct anyway...)
+            if (hasSSAO) {
+                finalColor = finalColor * GetAO(fb, x, y);
+            }
+
+            // Emissive color
+            if (any(emissiveMask)) {
+                VInt G3r = VInt::load(fb.GetAttachmentBuffer<uint32_t>(FbEmissiveId, tileOffset));
+                G3r = csel(emissiveMask, G3r, 0);
+
+                VFloat3 emissiveColor = VFloat3(UnpackRGBA(G3r));
+                finalColor = finalColor + SrgbToLinear(emissiveColor);
+            }
+        }
+
+        if (any(skyMask) && SkyboxTex != nullptr) {
+            auto& envTex = BlurSkybox ? FilteredEnvMap : SkyboxTex;
+            VFloat3 skyColor = envTex->SampleCube<EnvSampler>(worldPos - ViewPos, 1);
+
+            finalColor.x = csel(skyMask, skyColor.x, finalColor.x);
+            finalColor.y = csel(skyMask, skyColor.y, finalColor.y);
+            finalColor.z = csel(skyMask, skyColor.z, finalColor.z);
+        }
+
+        finalColor = Tonemap_Unreal(finalColor * Exposure);
+
+        VInt packedColor = PackRGBA({ finalColor, 1.0f });
+        packedColor.store(&fb.ColorBuffer[tileOffset]);
+
+        if (EnableTAA && FrameNo != 0) {
+            VFloat4 prevNDC = PerspectiveDiv(TransformVector(PrevProjMat, { VFloat3(worldPos), 1.0f }));
+            prevNDC.x -= Jitter.x;
+            prevNDC.y -= Jitter.y;
+            prevNDC = prevNDC * 0.5 + 0.5;
+
+            VInt prevX = round2i(prevNDC.x * fb.Width);
+            VInt prevY = round2i(prevNDC.y * fb.Height);
+
+            // Save prevColor to avoid having to recompute worldDepth on the TAA pass
+            VInt prevColor = PrevFrame->SampleColor(prevX, prevY, packedColor);
+            prevColor.store(fb.GetAttachmentBuffer<int32_t>(FbNormalsId, tileOffset));
+        }
+    }
+
+    // Blends the current color with the one reprojected from the previous frame, saved by ComposeTile().
+    // Only pixels within `bounds` (min XY, exclusive max XY) are sampled.
+    void ResolveTAATile(swr::Framebuffer& fb, uint32_t x, uint32_t y, const glm::uvec4& bounds) {
+        uint32_t tileOffset = fb.GetPixelOffset(x, y);
+        VInt currColor = VInt::load(&fb.ColorBuffer[tileOffset]);
+        VInt prevColor = VInt::load(fb.GetAttachmentBuffer<int32_t>(FbNormalsId, tileOffset));
+
+        VInt minColor = (int32_t)0xFFFF'FFFF, maxColor = 0;
+        VInt tileX = (int32_t)x + swr::FragPixelOffsetsX();
+        VInt tileY = (int32_t)y + swr::FragPixelOffsetsY();
+        VInt minX = (int32_t)bounds.x, minY = (int32_t)bounds.y;
+        VInt maxX = (int32_t)bounds.z - 1, maxY = (int32_t)bounds.w - 1;
+
+        // Sample a 3x3 neighborhood to create a box in color space. Clamping to the bounds only drops
+        // samples outside of them, since the pixels along the edge are part of the neighborhood anyway.
+        for (int32_t xo = -1; xo <= 1; xo++) {
+            for (int32_t yo = -1; yo <= 1; yo++) {
+                VInt sx = min(max(tileX + xo, minX), maxX);
+                VInt sy = min(max(tileY + yo, minY), maxY);
+                VInt color = fb.SampleColor(sx, sy, currColor);
+                minColor = min_u8(minColor, color);
+                maxColor = max_u8(maxColor, color);
+            }
+        }
+        prevColor = min_u8(max_u8(prevColor, minColor), maxColor);
+
+        //VFloat3 currColorF = VFloat3(UnpackRGBA(currColor));
+        //VFloat3 prevColorF = VFloat3(UnpackRGBA(prevColor));
+        //VFloat3 resolvedColor = prevColorF + (currColorF - prevColorF) * 0.1f;
+        //VInt finalColor = PackRGBA({ resolvedColor, 1.0f });
+
+        // Fixed-point is a smidge faster
+        const int32_t alphaFx = (int32_t)(0.1f * ((1 << 15) - 1));
+        VInt alpha = alphaFx | alphaFx << 16;
+        VInt finalColor = lerp16((prevColor >> 0) & 0x00FF'00FF, (currColor >> 0) & 0x00FF'00FF, alpha) |
+                          lerp16((prevColor >> 8) & 0x00FF'00FF, (currColor >> 8) & 0x00FF'00FF, alpha) << 8;
+
+        finalColor.store(&ResolvedTAABuffer[tileOffset]);
+    }
+
     VFloat GetShadow(VFloat3 worldPos, VFloat NoL) {
         // I don't even know how I got these values, but the order has some impact on the final result.
         // Filament's disk is quite noisy even with TAA.
@@ -372,15 +341,14 @@ private:
         sx *= ShadowBuffer->Width;
         sy *= ShadowBuffer->Height;
 
-        // aesenc costs 5c/1t, this hash probably takes around ~8-10c on TGL.
-        VInt rng = _mm512_aesenc_epi128(re2i(sx) + (int32_t)FrameNo, _mm512_set1_epi32(0)) ^ 
-                   _mm512_aesenc_epi128(re2i(sy), _mm512_set1_epi32(0));
+        // With VAES the hash is a single aesenc (5c/1t), so this probably takes around ~8-10c on TGL.
+        VInt rng = hash(re2i(sx) + (int32_t)FrameNo) ^ hash(re2i(sy));
 
         VFloat rc, rs;
         VFloat randomAngle = conv2f(shrl(rng, 8)) * (tau / (1 << 24));
         sincos(randomAngle, rc, rs);
 
-        auto samples = _mm_set1_epi8(0);
+        VInt samples = 0;
 
         for (uint32_t i = 0; i < 8; i++) {
             VFloat jx = PoissonDisk[0][i], jy = PoissonDisk[1][i];
@@ -388,13 +356,13 @@ private:
             VFloat ry = jx * rs + jy * rc + sy;
 
             VFloat occlusionDepth = ShadowBuffer->SampleDepth(round2i(rx), round2i(ry));
-            samples = _mm_mask_add_epi8(samples, occlusionDepth >= currentDepth, samples, _mm_set1_epi8(1));
+            samples += csel(occlusionDepth >= currentDepth, VInt(1), 0);
         }
-        return conv2f(_mm512_cvtepi8_epi32(samples)) * (1.0f / 8);
+        return conv2f(samples) * (1.0f / 8);
     }
     static VFloat GetAO(swr::Framebuffer& fb, uint32_t x, uint32_t y) {
-        uint8_t* basePtr = fb.GetAttachmentBuffer<uint8_t>(8);
-        uint32_t stride = fb.Width / 2;
+        uint8_t* basePtr = fb.GetAttachmentBuffer<uint8_t>(FbOcclusionId);
+        uint32_t stride = fb.Attachments[FbOcclusionId].Width;
         uint8_t temp[4 * 4];
 
         for (uint32_t ty = 0; ty < 4; ty++) {
@@ -402,7 +370,7 @@ private:
                 temp[tx + ty * 4] = basePtr[((x + tx) / 2) + ((y + ty) / 2) * stride];
             }
         }
-        return conv2f(_mm512_cvtepu8_epi32(_mm_loadu_epi8(temp))) * (1.0f / 255);
+        return conv2f(VInt::load_u8(temp)) * (1.0f / 255);
     }
 
     static swr::HdrTexture2D GenerateIrradianceMap(const swr::HdrTexture2D& envTex) {
@@ -667,9 +635,301 @@ private:
     };
 
     friend struct SSAO;
+    friend struct SurfaceShader;
+};
+
+// G-Buffer pass of `DefaultShader`. This only holds per-draw uniforms, so that it is cheap to copy into deferred draws.
+struct SurfaceShader {
+    static const uint32_t NumCustomAttribs = 8;
+    static const bool PackFragments = true;
+
+    static constexpr swr::SamplerDesc SurfaceSampler = {
+        .Wrap = swr::WrapMode::Repeat,
+        .MagFilter = swr::FilterMode::Linear,
+        .MinFilter = swr::FilterMode::Nearest,  // Downsample with nearest for better perf, quality loss is quite subtle.
+        .EnableMips = true,
+    };
+
+    glm::mat4 ProjMat, ModelMat;
+    const swr::RgbaTexture2D* MaterialTex;  // See `scene::Material` for what's on this texture.
+
+    void ShadeVertices(const swr::VertexReader& data, swr::ShadedVertexPacket& vars) const {
+        VFloat3 pos = data.ReadAttribs<VFloat3>(&scene::Vertex::x);
+        vars.Position = TransformVector(ProjMat, { pos, 1.0f });
+
+        vars.SetAttribs(0, data.ReadAttribs<VFloat2>(&scene::Vertex::u));
+
+        VFloat3 norm = data.ReadAttribs<VFloat3>(&scene::Vertex::nx);
+        vars.SetAttribs(2, TransformNormal(ModelMat, norm));
+
+        VFloat3 tang = data.ReadAttribs<VFloat3>(&scene::Vertex::tx);
+        vars.SetAttribs(5, TransformNormal(ModelMat, tang));
+    }
+
+    void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const { ShadeSurface<false>(fb, vars); }
+
+    // `Resolved` is set by `VisibilityBuffer::Resolve()`, where barycentrics are already perspective-correct
+    // and the alpha test was done by the raster pass.
+    template<bool Resolved>
+    [[gnu::always_inline]] void ShadeSurface(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {
+        if constexpr (!Resolved) {
+            vars.ApplyPerspectiveCorrection();
+        }
+
+        VFloat u = vars.GetSmooth(0);
+        VFloat v = vars.GetSmooth(1);
+
+        VInt baseColor = MaterialTex->Sample<SurfaceSampler>(u, v, 0);
+        VFloat3 N = normalize(vars.GetSmooth<VFloat3>(2));
+
+        VFloat metalness = 0.0f;
+        VFloat roughness = 0.5f;
+
+        if (MaterialTex->NumLayers >= 2) [[likely]] {
+            VFloat4 SN = UnpackRGBA(MaterialTex->Sample<SurfaceSampler>(u, v, 1));
+            VFloat3 T = vars.GetSmooth<VFloat3>(5);
+
+            // Gram-schmidt process (produces higher-quality normal mapping on large meshes)
+            // Re-orthogonalize T with respect to N
+            T = normalize(T - dot(T, N) * N);
+            VFloat3 B = cross(N, T);
+
+            // Flip bitangent depending on whether UVs are mirrored - https://stackoverflow.com/a/44901073
+            // TODO: maybe cheaper to compute tangents using screen derivatives all the way. (maybe too blocky?)
+            VFloat det = (dFdy(u) * dFdx(v) - dFdx(u) * dFdy(v)) & -0.0f;
+            B = { B.x ^ det, B.y ^ det, B.z ^ det };  // det < 0 ? -B : B
+
+            // Reconstruct Z from 2-channel normap map
+            // https://aras-p.info/texts/CompactNormalStorage.html
+            // https://www.researchgate.net/publication/259000109_Real-Time_Normal_Map_DXT_Compression
+            // This isn't exact due to interpolation and mipmapping, but it's quite subtle after texturing anyway.
+            VFloat Sx = SN.x * 2.0f - 1.0f;
+            VFloat Sy = SN.y * 2.0f - 1.0f;
+            VFloat Sz = sqrt14(1.0f - (Sx * Sx + Sy * Sy));
+
+            N.x = T.x * Sx + B.x * Sy + N.x * Sz;
+            N.y = T.y * Sx + B.y * Sy + N.y * Sz;
+            N.z = T.z * Sx + B.z * Sy + N.z * Sz;
+
+            metalness = SN.z;
+            roughness = SN.w;
+        }
+        // G-Buffer channels
+        //               LSB 0  ...  31 MSB
+        //   #1 [24: BaseColor] [8: Metalness]
+        //   #2 [1: NormalSign] [1: HasEmissive] [10: Roughness] [20: EncNormal]
+        //   #3 [8: Unused] [24: EmissiveColor]
+        VInt alpha = shrl(baseColor, 24);
+
+        if constexpr (!Resolved) {
+            vars.TileMask &= alpha >= 128;  // alpha test
+        }
+
+        bool hasEmissive = MaterialTex->NumLayers >= 3 && any(alpha == 255);
+
+        if (hasEmissive) [[unlikely]] {
+            VInt emissiveColor = MaterialTex->Sample<SurfaceSampler>(u, v, 2);
+            vars.StoreFragments(fb.GetAttachmentBuffer<uint32_t>(DefaultShader::FbEmissiveId), emissiveColor);
+        }
+
+        VInt G1 = (baseColor & 0xFFFFFF) | round2i(metalness * 255.0f) << 24;
+        vars.StoreFragments(fb.ColorBuffer.get(), G1);
+
+        VInt G2 = DefaultShader::SignedOctEncode(N, roughness) | (hasEmissive ? 2 : 0);
+        vars.StoreFragments(fb.GetAttachmentBuffer<uint32_t>(DefaultShader::FbNormalsId), G2);
+    }
+};
+
+// Visibility buffer rendering (deferred texturing) for `SurfaceShader` draws. The raster pass only writes depth and the
+// ID of the nearest triangle into the color buffer, then `Resolve()` reconstructs barycentrics for each visible pixel and
+// shades it exactly once, writing the same G-Buffer as the forward path. Overdraw then only costs depth tests.
+// - http://filmicworlds.com/blog/visibility-buffer-rendering-with-material-graphs/
+// - https://jcgt.org/published/0002/02/04/
+class VisibilityBuffer {
+    struct Draw {
+        swr::VertexReader Vertices;
+        SurfaceShader Shader;
+        uint32_t FirstId;  // Pixel ID of the first triangle, others follow in index buffer order
+    };
+    std::vector<Draw> _draws;
+    uint32_t _nextId = 0;
+
+    // Raster pass. Alpha tested materials need UVs to discard fragments before they occlude anything.
+    template<bool AlphaTest>
+    struct IdShader {
+        static const uint32_t NumCustomAttribs = AlphaTest ? 2 : 0;
+
+        SurfaceShader Surface;
+        uint32_t FirstId;
+
+        void ShadeVertices(const swr::VertexReader& data, swr::ShadedVertexPacket& vars) const {
+            // Unused attributes are optimized away after inlining, and positions match the resolve pass exactly.
+            swr::ShadedVertexPacket surfaceVars;
+            Surface.ShadeVertices(data, surfaceVars);
+
+            vars.Position = surfaceVars.Position;
+            vars.Attribs[0] = surfaceVars.Attribs[0];
+            vars.Attribs[1] = surfaceVars.Attribs[1];
+        }
+
+        void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {
+            if constexpr (AlphaTest) {
+                vars.ApplyPerspectiveCorrection();
+
+                VInt baseColor = Surface.MaterialTex->Sample<SurfaceShader::SurfaceSampler>(vars.GetSmooth(0), vars.GetSmooth(1), 0);
+                vars.TileMask &= shrl(baseColor, 24) >= 128;
+            }
+            VInt((int32_t)(FirstId + vars.PrimitiveId)).store(&fb.ColorBuffer[vars.TileOffset], vars.TileMask);
+        }
+    };
+
+    // Recently resolved triangles, one per lane. Large triangles span many tiles, so this saves most of the
+    // vertex shading done by the resolve pass. Attributes are laid out as in `TrianglePacket` for `VaryingBuffer`.
+    struct TriangleCache {
+        swr::ShadedVertexPacket Vertices[3];
+        alignas(64) uint32_t Ids[VInt::Length];
+        uint32_t DrawIdx[VInt::Length];
+        float EdgeA[VInt::Length][3], EdgeB[VInt::Length][3], EdgeC[VInt::Length][3];
+        VMask ValidMask = 0;
+        uint32_t NextSlot = 0;
+    };
+
+    uint32_t LoadTriangle(TriangleCache& cache, uint32_t id, const swr::Framebuffer& fb) const {
+        VMask hitMask = cache.ValidMask & (VInt::load(cache.Ids) == (int32_t)id);
+        if (hitMask) return (uint32_t)std::countr_zero(hitMask);
+
+        uint32_t slot = cache.NextSlot;
+        cache.NextSlot = (slot + 1) % VInt::Length;
+        cache.ValidMask |= 1u << slot;
+        cache.Ids[slot] = id;
+
+        auto drawItr = std::upper_bound(_draws.begin(), _draws.end(), id, [](uint32_t i, const Draw& draw) { return i < draw.FirstId; });
+        const Draw& draw = *(drawItr - 1);
+        cache.DrawIdx[slot] = (uint32_t)(drawItr - 1 - _draws.begin());
+
+        // Shade the 3 vertices of the triangle in the first lanes. Indices are read one by one, a vector load
+        // would go past the end of the index buffer for the last triangles. Other lanes shade vertex 0.
+        swr::VertexReader reader = draw.Vertices;
+        alignas(64) int32_t indices[VInt::Length] = {};
+
+        for (uint32_t vi = 0; vi < 3; vi++) {
+            indices[vi] = (int32_t)reader.ReadIndex((id - draw.FirstId) * 3 + vi);
+        }
+        reader._Indices = VInt::load(indices);
+
+        swr::ShadedVertexPacket vtx;
+        draw.Shader.ShadeVertices(reader, vtx);
+
+        for (uint32_t j = 0; j < SurfaceShader::NumCustomAttribs; j++) {
+            float v0 = vtx.Attribs[j][0];
+            cache.Vertices[0].Attribs[j][slot] = v0;
+            cache.Vertices[1].Attribs[j][slot] = vtx.Attribs[j][1] - v0;
+            cache.Vertices[2].Attribs[j][slot] = vtx.Attribs[j][2] - v0;
+        }
+
+        // 2D homogeneous rasterization: with vertices scaled to pixel units before the perspective division, the
+        // cross product of two vertices gives the edge function opposite to the third, and normalizing the three gives
+        // perspective-correct barycentrics. Unlike the raster pass, this needs no clipping for vertices behind the camera.
+        float sx = fb.Width * 0.5f, sy = fb.Height * 0.5f;
+
+        for (uint32_t i = 0; i < 3; i++) {
+            uint32_t a = (i + 1) % 3, b = (i + 2) % 3;
+            float aw = vtx.Position.w[a], ax = (vtx.Position.x[a] + aw) * sx, ay = (vtx.Position.y[a] + aw) * sy;
+            float bw = vtx.Position.w[b], bx = (vtx.Position.x[b] + bw) * sx, by = (vtx.Position.y[b] + bw) * sy;
+
+            cache.EdgeA[slot][i] = ay * bw - aw * by;
+            cache.EdgeB[slot][i] = aw * bx - ax * bw;
+            cache.EdgeC[slot][i] = ax * by - ay * bx;
+        }
+        return slot;
+    }
+
+    void ResolveTile(swr::Framebuffer& fb, TriangleCache& cache, uint32_t x, uint32_t y) const {
+        uint32_t tileOffset = fb.GetPixelOffset(x, y);
+        VFloat depth = VFloat::load(&fb.DepthBuffer[tileOffset]);
+        VInt ids = VInt::load(&fb.ColorBuffer[tileOffset]);
+        VMask pendingMask = depth < 1.0f;
+
+        VFloat px = conv2f((int32_t)x + swr::FragPixelOffsetsX());
+        VFloat py = conv2f((int32_t)y + swr::FragPixelOffsetsY());
+
+        // Pixels are shaded in groups covered by the same triangle, most tiles only have one or two.
+        while (pendingMask) {
+            uint32_t id = (uint32_t)ids[(uint32_t)std::countr_zero(pendingMask)];
+            VMask triMask = pendingMask & (ids == (int32_t)id);
+            pendingMask ^= triMask;
+
+            uint32_t slot = LoadTriangle(cache, id, fb);
+            const Draw& draw = _draws[cache.DrawIdx[slot]];
+
+            VFloat edges[3];
+            for (uint32_t i = 0; i < 3; i++) {
+                edges[i] = fma(px, cache.EdgeA[slot][i], fma(py, cache.EdgeB[slot][i], cache.EdgeC[slot][i]));
+            }
+            VFloat rcpSum = 1.0f / (edges[0] + edges[1] + edges[2]);
+
+            swr::VaryingBuffer vars = {
+                .Attribs = (float*)&cache.Vertices->Attribs + slot,
+                .TileOffset = tileOffset,
+                .PrimitiveId = id - draw.FirstId,
+                .TileMask = triMask,
+                .W1 = edges[1] * rcpSum,
+                .W2 = edges[2] * rcpSum,
+                .Depth = depth,
+            };
+            draw.Shader.ShadeSurface<true>(fb, vars);
+        }
+    }
+
+public:
+    // Records a draw for the raster pass, which must be flushed by `rast` before calling `Resolve()`.
+    // The vertex buffers and textures used by `shader` must stay alive until then.
+    void Submit(swr::Rasterizer& rast, const swr::VertexReader& data, const SurfaceShader& shader, bool alphaTested) {
+        uint32_t numTriangles = data.Count / 3;
+        if (numTriangles == 0) return;
+
+        assert(_nextId + numTriangles > _nextId && "Too many triangles for 32-bit IDs");
+
+        _draws.push_back({ .Vertices = data, .Shader = shader, .FirstId = _nextId });
+
+        if (alphaTested) {
+            rast.Submit(data, IdShader<true>{ .Surface = shader, .FirstId = _nextId });
+        } else {
+            rast.Submit(data, IdShader<false>{ .Surface = shader, .FirstId = _nextId });
+        }
+        _nextId += numTriangles;
+    }
+
+    // Shades all pixels with depth < 1 into the G-Buffer, replacing their IDs, then clears recorded draws.
+    void Resolve(swr::Framebuffer& fb) {
+        swr::ThreadPool::Shared().ParallelFor(fb.Height / 4, 0, [&](uint32_t row) { ResolveRegion(fb, 0, row * 4, fb.Width, 4); });
+        EndResolve();
+    }
+
+    // Same as Resolve() for a single region aligned to tiles, e.g. from the callback of `Rasterizer::Flush()`.
+    // Regions can be resolved in parallel, EndResolve() must be called once all of them are done.
+    void ResolveRegion(swr::Framebuffer& fb, uint32_t x, uint32_t y, uint32_t width, uint32_t height) const {
+        TriangleCache cache;
+
+        // Barycentrics are normalized, so W is the same for all vertices and perspective correction is a no-op.
+        for (uint32_t i = 0; i < 3; i++) {
+            cache.Vertices[i].Position.w = 1.0f;
+        }
+        for (uint32_t ty = y; ty < y + height; ty += 4) {
+            for (uint32_t tx = x; tx < x + width; tx += 4) {
+                ResolveTile(fb, cache, tx, ty);
+            }
+        }
+    }
+
+    void EndResolve() {
+        _draws.clear();
+        _nextId = 0;
+    }
 };
 struct DepthOnlyShader {
     static const uint32_t NumCustomAttribs = 0;
+    static constexpr swr::PipelineState Pipeline = { .ColorWrite = false };
 
     glm::mat4 ProjMat;
 
@@ -678,12 +938,12 @@ struct DepthOnlyShader {
         vars.Position = TransformVector(ProjMat, pos);
     }
 
-    void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {
-        _mm512_mask_storeu_ps(&fb.DepthBuffer[vars.TileOffset], vars.TileMask, vars.Depth);
-    }
+    void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {}
 };
+// Counts all fragments, including occluded ones.
 struct OverdrawShader {
     static const uint32_t NumCustomAttribs = 0;
+    static constexpr swr::PipelineState Pipeline = { .DepthTest = swr::DepthFunc::Always, .DepthWrite = false };
 
     glm::mat4 ProjMat;
 
@@ -694,15 +954,15 @@ struct OverdrawShader {
 
     void ShadePixels(swr::Framebuffer& fb, swr::VaryingBuffer& vars) const {
         VInt color = VInt::load(&fb.ColorBuffer[vars.TileOffset]);
-        color = _mm512_adds_epu8(color, _mm512_set1_epi32((int32_t)0xFF'000020));
-        fb.WriteTile(vars.TileOffset, 0xFFFF, color, vars.Depth);
+        color = adds_u8(color, (int32_t)0xFF'000020);
+        color.store(&fb.ColorBuffer[vars.TileOffset], vars.TileMask);
     }
 };
 
 // TODO: Implement possibly better and faster approach from "Scalable Ambient Obscurance" +/or maybe copy a few tricks from XeGTAO or something?
 // https://www.shadertoy.com/view/3dK3zR
 struct SSAO {
-    static const uint32_t KernelSize = 16, FbAttachId = 8;
+    static const uint32_t KernelSize = 16, FbAttachId = DefaultShader::FbOcclusionId;
 
     float Radius = 1.3f, MaxRange = 0.35f;
 
@@ -742,7 +1002,7 @@ struct SSAO {
         invProj = glm::translate(invProj, glm::vec3(-1.0f, -1.0f, 0.0f));
         invProj = glm::scale(invProj, glm::vec3(2.0f / fb.Width, 2.0f / fb.Height, 1.0f));
 
-        uint32_t stride = fb.Width / 2;
+        uint32_t stride = fb.Attachments[FbAttachId].Width;
         uint8_t* aoBuffer = fb.GetAttachmentBuffer<uint8_t>(FbAttachId);
 
         XorShiftStep(_randSeed); // update RNG on each frame for TAA
@@ -750,8 +1010,8 @@ struct SSAO {
         fb.IterateTiles([&](uint32_t x, uint32_t y) {
             VInt rng = _randSeed * (int32_t)(x * 12345 + y * 9875);
 
-            VInt iu = (int32_t)x + swr::FragPixelOffsetsX * 2;
-            VInt iv = (int32_t)y + swr::FragPixelOffsetsY * 2;
+            VInt iu = (int32_t)x + swr::FragPixelOffsetsX() * 2;
+            VInt iv = (int32_t)y + swr::FragPixelOffsetsY() * 2;
             VFloat z = depthMap.SampleDepth(iu, iv, 0);
 
             if (!any(z < 1.0f)) return; // skip over tiles that don't have geometry
@@ -764,7 +1024,7 @@ struct SSAO {
             // VFloat3 N = normalize(cross(posDx, posDy));
 
             // Using textured normals is better than reconstructing from blocky derivatives, particularly around edges.
-            VInt G2r = VInt::gather<4>(fb.GetAttachmentBuffer<uint32_t>(0), fb.GetPixelOffset(iu, iv));
+            VInt G2r = VInt::gather<4>(fb.GetAttachmentBuffer<uint32_t>(DefaultShader::FbNormalsId), fb.GetPixelOffset(iu, iv));
             VFloat3 N = VFloat3(DefaultShader::SignedOctDecode(G2r));
 
             XorShiftStep(rng);
@@ -778,7 +1038,7 @@ struct SSAO {
             });
             VFloat3 B = cross(N, T);
 
-            auto occlusion = _mm_set1_epi8(0);
+            VInt occlusion = 0;
 
             for (uint32_t i = 0; i < KernelSize; i++) {
                 VFloat kx = Kernel[0][i], ky = Kernel[1][i], kz = Kernel[2][i];
@@ -795,22 +1055,22 @@ struct SSAO {
 
                 VMask rangeMask = sampleDist < MaxRange;
                 VMask occluMask = sampleDepth <= LinearizeDepth(samplePos.z) - 0.03f;
-                occlusion = _mm_sub_epi8(occlusion, _mm_movm_epi8(occluMask & rangeMask));
+                occlusion += csel(occluMask & rangeMask, VInt(1), 0);
 
                 // float rangeCheck = abs(origin.z - sampleDepth) < uRadius ? 1.0 : 0.0;
                 // occlusion += (sampleDepth <= sample.z ? 1.0 : 0.0) * rangeCheck;
             }
-            occlusion = _mm_slli_epi16(occlusion, 9 - std::bit_width(KernelSize));
-            occlusion = _mm_sub_epi8(_mm_set1_epi8((char)255), occlusion);
+            occlusion = 255 - min(occlusion << (9 - std::bit_width(KernelSize)), 255);
 
             // pow(occlusion, 3)
-            __m256i o1 = _mm256_cvtepu8_epi16(occlusion);
-            __m256i o2 = _mm256_srli_epi16(_mm256_mullo_epi16(o1, o1), 8);
-            __m256i o3 = _mm256_srli_epi16(_mm256_mullo_epi16(o1, o2), 8);
-            occlusion = _mm256_cvtepi16_epi8(o3);
+            VInt o2 = (occlusion * occlusion) >> 8;
+            VInt o3 = (occlusion * o2) >> 8;
+
+            uint8_t packed[16];
+            o3.store_u8(packed);
 
             for (uint32_t sy = 0; sy < 4; sy++) {
-                std::memcpy(&aoBuffer[(x / 2) + (y / 2 + sy) * stride], (uint32_t*)&occlusion + sy, 4);
+                std::memcpy(&aoBuffer[(x / 2) + (y / 2 + sy) * stride], &packed[sy * 4], 4);
             }
         }, 2);
 
@@ -818,37 +1078,64 @@ struct SSAO {
     }
 
 private:
-    static void ApplyBlur(swr::Framebuffer& fb) {
+    swr::AlignedBuffer<uint8_t> _blurBuffer;
+    uint32_t _blurBufferSize = 0;
+
+    void ApplyBlur(swr::Framebuffer& fb) {
+        const swr::Framebuffer::Attachment& att = fb.Attachments[FbAttachId];
         uint8_t* aoBuffer = fb.GetAttachmentBuffer<uint8_t>(FbAttachId);
-        uint32_t stride = fb.Width / 2;
-        // Box blur
-        // No clamping of course, as long as it doesn't crash it's fine :)
-        // Buffer size is actually W*H, but we use half of that - it's really okay.
-        uint32_t altBufferOffset = (fb.Height / 2) * stride;
-
-        for (uint32_t y = 0; y < fb.Height / 2; y++) {
-            for (uint32_t x = 0; x < fb.Width / 2; x += 32) {
-                uint8_t* src = &aoBuffer[x + y * stride];
-                BlurX32(src + altBufferOffset, src, 1);
-            }
+        uint32_t stride = att.Width;
+
+        // Box blur, edges are clamped. The attachment isn't padded, so both passes go through a temp buffer whose
+        // rows are rounded up to whole 16-wide blocks, with a copy of the first and last rows above and below.
+        // The first 32 bytes hold the current source row for the horizontal pass, with its edge pixels extended.
+        uint32_t tempStride = (att.Width + 15) & ~15u;
+        uint32_t tempSize = 32 + tempStride + (att.Height + 2) * tempStride;
+        if (_blurBufferSize < tempSize) {
+            _blurBuffer = swr::alloc_buffer<uint8_t>(tempSize);
+            _blurBufferSize = tempSize;
         }
+        uint8_t* rowBuffer = &_blurBuffer[16];
+        uint8_t* tempBuffer = &_blurBuffer[32 + tempStride + tempStride];
+
+        for (uint32_t y = 0; y < att.Height; y++) {
+            const uint8_t* src = &aoBuffer[y * stride];
+            std::memcpy(rowBuffer, src, att.Width);
+            std::memset(&rowBuffer[att.Width], src[att.Width - 1], tempStride - att.Width + 1);
+            rowBuffer[-1] = src[0];
 
-        for (uint32_t y = 0; y < fb.Height / 2; y++) {
-            for (uint32_t x = 0; x < fb.Width / 2; x += 32) {
-                uint8_t* src = &aoBuffer[x + y * stride];
-                BlurX32(src, src + altBufferOffset, (int32_t)stride);
+            for (uint32_t x = 0; x < att.Width; x += 16) {
+                BlurX16(&tempBuffer[x + y * tempStride], &rowBuffer[x], 1);
+            }
+        }
+        std::memcpy(&tempBuffer[-(int32_t)tempStride], &tempBuffer[0], tempStride);
+        std::memcpy(&tempBuffer[att.Height * tempStride], &tempBuffer[(att.Height - 1) * tempStride], tempStride);
+
+        for (uint32_t y = 0; y < att.Height; y++) {
+            for (uint32_t x = 0; x < att.Width; x += 16) {
+                uint8_t* dst = &aoBuffer[x + y * stride];
+                uint8_t* src = &tempBuffer[x + y * tempStride];
+
+                if (x + 16 <= att.Width) {
+                    BlurX16(dst, src, (int32_t)tempStride);
+                } else {
+                    uint8_t tail[16];
+                    BlurX16(tail, src, (int32_t)tempStride);
+                    std::memcpy(dst, tail, att.Width - x);
+                }
             }
         }
     }
-    static void BlurX32(uint8_t* dst, uint8_t* src, int32_t lineStride) {
+    static void BlurX16(uint8_t* dst, const uint8_t* src, int32_t lineStride) {
         const int BlurRadius = 1, BlurSamples = BlurRadius * 2 + 1;
-        __m512i accum = _mm512_set1_epi16(0);
+        VInt accum = 0;
 
         for (int32_t so = -BlurRadius; so <= BlurRadius; so++) {
-            accum = _mm512_add_epi16(accum, _mm512_cvtepu8_epi16(_mm256_loadu_epi8(&src[so * lineStride])));
+            accum += VInt::load_u8(&src[so * lineStride]);
         }
-        __m256i c = _mm512_cvtepi16_epi8(_mm512_mulhrs_epi16(accum, _mm512_set1_epi16(32767 / BlurSamples)));
-        _mm256_storeu_epi8(dst, c);
+        // mulhrs(accum, 1/N)
+        VInt c = (accum * (32767 / BlurSamples) + (1 << 14)) >> 15;
+        c.store_u8(dst);
     }
 
     static VFloat LinearizeDepth(VFloat d) {
@@ -0,0 +1,341 @@
+#pragma once
+
+// AVX2 backend: vectors are kept 16-wide as two 8-lane halves, so the 4x4 fragment layout
+// and everything built on top of it stays identical to the AVX-512 backend.
+// Requires AVX2 + FMA + F16C (Haswell and later, Zen 1 and later).
+// Included by SIMD.h, don't include this directly.
+
+namespace swr::inline SWR_ISA_NS {
+
+namespace simd::detail {
+
+// Expands 8 bits of `mask` (starting at `shift`) to a lane mask.
+inline __m256i ExpandMask(VMask mask, uint32_t shift) {
+    __m256i bits = _mm256_setr_epi32(1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7);
+    __m256i m = _mm256_set1_epi32(mask >> shift);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(m, bits), bits);
+}
+inline VMask MoveMask(__m256 lo, __m256 hi) {
+    return (VMask)(_mm256_movemask_ps(lo) | _mm256_movemask_ps(hi) << 8);
+}
+inline VMask MoveMask(__m256i lo, __m256i hi) {
+    return MoveMask(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi));
+}
+
+};  // namespace simd::detail
+
+struct alignas(64) VInt {
+    static const uint32_t Length = 16;
+
+    __m256i reg[2];
+
+    VInt() { reg[0] = reg[1] = _mm256_setzero_si256(); }
+    VInt(__m256i lo, __m256i hi) { reg[0] = lo, reg[1] = hi; }
+    VInt(int32_t x) { reg[0] = reg[1] = _mm256_set1_epi32(x); }
+
+    inline int32_t& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((int32_t*)&reg)[idx];
+    }
+
+    static inline VInt load(const void* ptr) {
+        return { _mm256_loadu_si256((const __m256i*)ptr + 0), _mm256_loadu_si256((const __m256i*)ptr + 1) };
+    }
+    inline void store(void* ptr) const {
+        _mm256_storeu_si256((__m256i*)ptr + 0, reg[0]);
+        _mm256_storeu_si256((__m256i*)ptr + 1, reg[1]);
+    }
+    inline void store(void* ptr, VMask mask) const {
+        _mm256_maskstore_epi32((int*)ptr + 0, simd::detail::ExpandMask(mask, 0), reg[0]);
+        _mm256_maskstore_epi32((int*)ptr + 8, simd::detail::ExpandMask(mask, 8), reg[1]);
+    }
+
+    // Non-temporal store, `ptr` must be aligned to 64 bytes.
+    inline void stream(void* ptr) const {
+        _mm256_stream_si256((__m256i*)ptr + 0, reg[0]);
+        _mm256_stream_si256((__m256i*)ptr + 1, reg[1]);
+    }
+
+    // Zero-extending loads of 16 packed bytes/shorts.
+    static inline VInt load_u8(const void* ptr) {
+        __m128i v = _mm_loadu_si128((const __m128i*)ptr);
+        return { _mm256_cvtepu8_epi32(v), _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)) };
+    }
+    static inline VInt load_u16(const void* ptr) {
+        return { _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)ptr + 0)),
+                 _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)ptr + 1)) };
+    }
+    // Truncating store of the low byte of each lane.
+    inline void store_u8(void* ptr) const {
+        __m256i shuffMask = _mm256_setr_epi32(0x0C'08'04'00, -1, -1, -1, -1, 0x0C'08'04'00, -1, -1);
+        __m256i lo = _mm256_shuffle_epi8(reg[0], shuffMask);  // [0..3 _ _ _ | _ 4..7 _ _]
+        __m256i hi = _mm256_shuffle_epi8(reg[1], shuffMask);
+        __m128i a = _mm_or_si128(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+        __m128i b = _mm_or_si128(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+        _mm_storeu_si128((__m128i*)ptr, _mm_unpacklo_epi64(a, b));
+    }
+
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices) {
+        return { _mm256_i32gather_epi32((const int*)basePtr, indices.reg[0], IndexScale),
+                 _mm256_i32gather_epi32((const int*)basePtr, indices.reg[1], IndexScale) };
+    }
+
+    // Gathers active lanes and takes `fallback` for the others. Inactive lanes are not accessed.
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices, VMask mask, VInt fallback) {
+        return { _mm256_mask_i32gather_epi32(fallback.reg[0], (const int*)basePtr, indices.reg[0], simd::detail::ExpandMask(mask, 0), IndexScale),
+                 _mm256_mask_i32gather_epi32(fallback.reg[1], (const int*)basePtr, indices.reg[1], simd::detail::ExpandMask(mask, 8), IndexScale) };
+    }
+
+    static inline VInt ramp() { return { _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15) }; }
+};
+struct alignas(64) VFloat {
+    static const uint32_t Length = 16;
+
+    __m256 reg[2];
+
+    VFloat() { reg[0] = reg[1] = _mm256_setzero_ps(); }
+    VFloat(__m256 lo, __m256 hi) { reg[0] = lo, reg[1] = hi; }
+    VFloat(float x) { reg[0] = reg[1] = _mm256_set1_ps(x); }
+
+    inline float& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((float*)&reg)[idx];
+    }
+
+    static inline VFloat load(const void* ptr) { return { _mm256_loadu_ps((const float*)ptr + 0), _mm256_loadu_ps((const float*)ptr + 8) }; }
+    inline void store(void* ptr) const {
+        _mm256_storeu_ps((float*)ptr + 0, reg[0]);
+        _mm256_storeu_ps((float*)ptr + 8, reg[1]);
+    }
+    inline void store(void* ptr, VMask mask) const {
+        _mm256_maskstore_ps((float*)ptr + 0, simd::detail::ExpandMask(mask, 0), reg[0]);
+        _mm256_maskstore_ps((float*)ptr + 8, simd::detail::ExpandMask(mask, 8), reg[1]);
+    }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices) {
+        return { _mm256_i32gather_ps((const float*)basePtr, indices.reg[0], IndexScale),
+                 _mm256_i32gather_ps((const float*)basePtr, indices.reg[1], IndexScale) };
+    }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices, VMask mask, VFloat fallback) {
+        return { _mm256_mask_i32gather_ps(fallback.reg[0], (const float*)basePtr, indices.reg[0],
+                                          _mm256_castsi256_ps(simd::detail::ExpandMask(mask, 0)), IndexScale),
+                 _mm256_mask_i32gather_ps(fallback.reg[1], (const float*)basePtr, indices.reg[1],
+                                          _mm256_castsi256_ps(simd::detail::ExpandMask(mask, 8)), IndexScale) };
+    }
+
+    static inline VFloat ramp() { return { _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_setr_ps(8, 9, 10, 11, 12, 13, 14, 15) }; }
+};
+
+// Applies a 256-bit intrinsic on both halves
+#define _SIMD_BINOP(V, Fn, a, b) V(Fn(a.reg[0], b.reg[0]), Fn(a.reg[1], b.reg[1]))
+#define _SIMD_CMPOP(Fn, a, b) simd::detail::MoveMask(Fn(a.reg[0], b.reg[0]), Fn(a.reg[1], b.reg[1]))
+
+#define _SIMD_DEF_OPERATORS(V, OpSuffix, MulOp, BitSuffix)                                 \
+    inline V operator+(V a, V b) { return _SIMD_BINOP(V, _mm256_add_##OpSuffix, a, b); }  \
+    inline V operator-(V a, V b) { return _SIMD_BINOP(V, _mm256_sub_##OpSuffix, a, b); }  \
+    inline V operator*(V a, V b) { return _SIMD_BINOP(V, _mm256_##MulOp, a, b); }         \
+    inline V operator&(V a, V b) { return _SIMD_BINOP(V, _mm256_and_##BitSuffix, a, b); } \
+    inline V operator|(V a, V b) { return _SIMD_BINOP(V, _mm256_or_##BitSuffix, a, b); }  \
+    inline V operator^(V a, V b) { return _SIMD_BINOP(V, _mm256_xor_##BitSuffix, a, b); } \
+                                                                                           \
+    inline V operator+=(V& a, V b) { return a = (a + b); }                                 \
+    inline V operator-=(V& a, V b) { return a = (a - b); }                                 \
+    inline V operator*=(V& a, V b) { return a = (a * b); }
+
+_SIMD_DEF_OPERATORS(VFloat, ps, mul_ps, ps);
+inline VFloat operator/(VFloat a, VFloat b) { return _SIMD_BINOP(VFloat, _mm256_div_ps, a, b); }
+inline VFloat operator-(VFloat a) { return a ^ -0.0f; }
+
+namespace simd::detail {
+
+inline __m256 cmplt_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline __m256 cmpgt_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline __m256 cmple_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline __m256 cmpge_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline __m256 cmpeq_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline __m256 cmpne_ps(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+
+inline __m256i cmplt_epi32(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(b, a); }
+
+};  // namespace simd::detail
+
+inline VMask operator<(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmplt_ps, a, b); }
+inline VMask operator>(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmpgt_ps, a, b); }
+inline VMask operator<=(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmple_ps, a, b); }
+inline VMask operator>=(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmpge_ps, a, b); }
+inline VMask operator==(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmpeq_ps, a, b); }
+inline VMask operator!=(VFloat a, VFloat b) { return _SIMD_CMPOP(simd::detail::cmpne_ps, a, b); }
+
+_SIMD_DEF_OPERATORS(VInt, epi32, mullo_epi32, si256);
+inline VInt operator>>(VInt a, uint32_t b) { return { _mm256_srai_epi32(a.reg[0], (int)b), _mm256_srai_epi32(a.reg[1], (int)b) }; }
+inline VInt operator<<(VInt a, uint32_t b) { return { _mm256_slli_epi32(a.reg[0], (int)b), _mm256_slli_epi32(a.reg[1], (int)b) }; }
+
+inline VInt operator>>(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_srav_epi32, a, b); }
+inline VInt operator<<(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_sllv_epi32, a, b); }
+
+// Masks are only 16 bits, so the negated compares are cheaper done on the scalar side.
+inline VMask operator<(VInt a, VInt b) { return _SIMD_CMPOP(simd::detail::cmplt_epi32, a, b); }
+inline VMask operator>(VInt a, VInt b) { return _SIMD_CMPOP(_mm256_cmpgt_epi32, a, b); }
+inline VMask operator==(VInt a, VInt b) { return _SIMD_CMPOP(_mm256_cmpeq_epi32, a, b); }
+inline VMask operator<=(VInt a, VInt b) { return (VMask)~(a > b); }
+inline VMask operator>=(VInt a, VInt b) { return (VMask)~(a < b); }
+inline VMask operator!=(VInt a, VInt b) { return (VMask)~(a == b); }
+
+#undef _SIMD_DEF_OPERATORS
+
+namespace simd {
+
+inline VInt round2i(VFloat x) { return { _mm256_cvtps_epi32(x.reg[0]), _mm256_cvtps_epi32(x.reg[1]) }; }
+inline VInt trunc2i(VFloat x) { return { _mm256_cvttps_epi32(x.reg[0]), _mm256_cvttps_epi32(x.reg[1]) }; }
+inline VFloat conv2f(VInt x) { return { _mm256_cvtepi32_ps(x.reg[0]), _mm256_cvtepi32_ps(x.reg[1]) }; }
+
+inline VInt re2i(VFloat x) { return { _mm256_castps_si256(x.reg[0]), _mm256_castps_si256(x.reg[1]) }; }  // reinterpret float bits to int
+inline VFloat re2f(VInt x) { return { _mm256_castsi256_ps(x.reg[0]), _mm256_castsi256_ps(x.reg[1]) }; }  // reinterpret int to float bits
+
+inline VInt min(VInt x, VInt y) { return _SIMD_BINOP(VInt, _mm256_min_epi32, x, y); }
+inline VInt max(VInt x, VInt y) { return _SIMD_BINOP(VInt, _mm256_max_epi32, x, y); }
+
+inline VFloat min(VFloat x, VFloat y) { return _SIMD_BINOP(VFloat, _mm256_min_ps, x, y); }
+inline VFloat max(VFloat x, VFloat y) { return _SIMD_BINOP(VFloat, _mm256_max_ps, x, y); }
+
+//x * y + z
+inline VFloat fma(VFloat x, VFloat y, VFloat z) {
+    return { _mm256_fmadd_ps(x.reg[0], y.reg[0], z.reg[0]), _mm256_fmadd_ps(x.reg[1], y.reg[1], z.reg[1]) };
+}
+//x * y - z
+inline VFloat fms(VFloat x, VFloat y, VFloat z) {
+    return { _mm256_fmsub_ps(x.reg[0], y.reg[0], z.reg[0]), _mm256_fmsub_ps(x.reg[1], y.reg[1], z.reg[1]) };
+}
+//-(x * y) + z
+inline VFloat fnma(VFloat x, VFloat y, VFloat z) {
+    return { _mm256_fnmadd_ps(x.reg[0], y.reg[0], z.reg[0]), _mm256_fnmadd_ps(x.reg[1], y.reg[1], z.reg[1]) };
+}
+
+// Linear interpolation between `a` and `b`: `a*(1-t) + b*t`
+// https://fgiesen.wordpress.com/2012/08/15/linear-interpolation-past-present-and-future/
+inline VFloat lerp(VFloat a, VFloat b, VFloat t) { return fma(t, b, fnma(t, a, a)); }
+
+inline VFloat sqrt(VFloat x) { return { _mm256_sqrt_ps(x.reg[0]), _mm256_sqrt_ps(x.reg[1]) }; }
+// approximate reciprocal sqrt (12-bits precision, 14 on AVX-512)
+inline VFloat rsqrt14(VFloat x) { return { _mm256_rsqrt_ps(x.reg[0]), _mm256_rsqrt_ps(x.reg[1]) }; }
+// approximate sqrt (12-bits precision, 14 on AVX-512)
+inline VFloat sqrt14(VFloat x) { return rsqrt14(x) * x; }
+// approximate reciprocal (12-bits precision, 14 on AVX-512)
+inline VFloat rcp14(VFloat x) { return { _mm256_rcp_ps(x.reg[0]), _mm256_rcp_ps(x.reg[1]) }; }
+
+inline VFloat abs(VFloat x) { return re2f(re2i(x) & 0x7FFFFFFF); }
+inline VInt abs(VInt x) { return { _mm256_abs_epi32(x.reg[0]), _mm256_abs_epi32(x.reg[1]) }; }
+
+// lanewise: cond ? a : b
+inline VFloat csel(VMask cond, VFloat a, VFloat b) {
+    return { _mm256_blendv_ps(b.reg[0], a.reg[0], _mm256_castsi256_ps(detail::ExpandMask(cond, 0))),
+             _mm256_blendv_ps(b.reg[1], a.reg[1], _mm256_castsi256_ps(detail::ExpandMask(cond, 8))) };
+}
+inline VInt csel(VMask cond, VInt a, VInt b) {
+    return { _mm256_blendv_epi8(b.reg[0], a.reg[0], detail::ExpandMask(cond, 0)),
+             _mm256_blendv_epi8(b.reg[1], a.reg[1], detail::ExpandMask(cond, 8)) };
+}
+
+// unsigned compares
+inline VMask ult(VInt a, VInt b) { return (a ^ INT32_MIN) < (b ^ INT32_MIN); }
+inline VMask uge(VInt a, VInt b) { return (VMask)~ult(a, b); }
+
+// 16-bit linear interpolation with 15-bit interpolant: a + (b - a) * t
+// mulhrs(a, b) = (a * b + (1 << 14)) >> 15
+inline VInt lerp16(VInt a, VInt b, VInt t) {
+    return { _mm256_add_epi16(a.reg[0], _mm256_mulhrs_epi16(_mm256_sub_epi16(b.reg[0], a.reg[0]), t.reg[0])),
+             _mm256_add_epi16(a.reg[1], _mm256_mulhrs_epi16(_mm256_sub_epi16(b.reg[1], a.reg[1]), t.reg[1])) };
+}
+
+// Per-byte unsigned min/max and saturating add
+inline VInt min_u8(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_min_epu8, a, b); }
+inline VInt max_u8(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_max_epu8, a, b); }
+inline VInt adds_u8(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_adds_epu8, a, b); }
+
+// shift right logical
+inline VInt shrl(VInt a, uint32_t b) { return { _mm256_srli_epi32(a.reg[0], (int)b), _mm256_srli_epi32(a.reg[1], (int)b) }; }
+inline VInt shrl(VInt a, VInt b) { return _SIMD_BINOP(VInt, _mm256_srlv_epi32, a, b); }
+
+// Lanewise table lookup: table[idx & 15]
+inline VFloat permute(VFloat table, VInt idx) {
+    VFloat sel = re2f(idx << 28);  // bit 3 to sign
+    __m256 r0 = _mm256_blendv_ps(_mm256_permutevar8x32_ps(table.reg[0], idx.reg[0]),
+                                 _mm256_permutevar8x32_ps(table.reg[1], idx.reg[0]), sel.reg[0]);
+    __m256 r1 = _mm256_blendv_ps(_mm256_permutevar8x32_ps(table.reg[0], idx.reg[1]),
+                                 _mm256_permutevar8x32_ps(table.reg[1], idx.reg[1]), sel.reg[1]);
+    return { r0, r1 };
+}
+inline VInt permute(VInt table, VInt idx) { return re2i(permute(re2f(table), idx)); }
+// Lanewise lookup into a 32-entry table: concat(lo, hi)[idx & 31]
+inline VInt permute2(VInt lo, VInt hi, VInt idx) { return csel((idx & 16) != 0, permute(hi, idx), permute(lo, idx)); }
+
+// Converts the low 16 bits of each lane from half to single precision
+inline VFloat f16tof32(VInt x) {
+    x = x & 0xFFFF;
+    __m128i lo = _mm_packus_epi32(_mm256_castsi256_si128(x.reg[0]), _mm256_extracti128_si256(x.reg[0], 1));
+    __m128i hi = _mm_packus_epi32(_mm256_castsi256_si128(x.reg[1]), _mm256_extracti128_si256(x.reg[1], 1));
+    return { _mm256_cvtph_ps(lo), _mm256_cvtph_ps(hi) };
+}
+// Converts to half precision, zero-extended to 32 bits
+inline VInt f32tof16(VFloat x) {
+    return { _mm256_cvtepu16_epi32(_mm256_cvtps_ph(x.reg[0], _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)),
+             _mm256_cvtepu16_epi32(_mm256_cvtps_ph(x.reg[1], _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)) };
+}
+
+// Packs the low byte of each component with unsigned saturation: r | g << 8 | b << 16 | a << 24
+inline VInt pack_u8x4(VInt r, VInt g, VInt b, VInt a) {
+    auto rg = _SIMD_BINOP(VInt, _mm256_packs_epi32, r, g);
+    auto ba = _SIMD_BINOP(VInt, _mm256_packs_epi32, b, a);
+    auto cb = _SIMD_BINOP(VInt, _mm256_packus_epi16, rg, ba);
+
+    auto shuffMask = _mm256_setr_epi32(0x0C'08'04'00, 0x0D'09'05'01, 0x0E'0A'06'02, 0x0F'0B'07'03,  //
+                                       0x0C'08'04'00, 0x0D'09'05'01, 0x0E'0A'06'02, 0x0F'0B'07'03);
+    return { _mm256_shuffle_epi8(cb.reg[0], shuffMask), _mm256_shuffle_epi8(cb.reg[1], shuffMask) };
+}
+
+// De-interleave vertex indices via 8x3 transpose - https://stackoverflow.com/a/69083795
+inline void transpose8x3(__m256i v[3]) {
+    auto a = _mm256_blend_epi32(_mm256_blend_epi32(v[1], v[0], 0b01'001'001), v[2], 0b00'100'100);
+    auto b = _mm256_blend_epi32(_mm256_blend_epi32(v[0], v[2], 0b01'001'001), v[1], 0b00'100'100);
+    auto c = _mm256_blend_epi32(_mm256_blend_epi32(v[2], v[1], 0b01'001'001), v[0], 0b00'100'100);
+
+    v[0] = _mm256_permutevar8x32_epi32(a, _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5));
+    v[1] = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6));
+    v[2] = _mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7));
+}
+// The 48 input elements split evenly into two 8x3 transposes: [v0.lo v0.hi v1.lo] and [v1.hi v2.lo v2.hi].
+inline void transpose16x3(VInt v[3]) {
+    __m256i a[3] = { v[0].reg[0], v[0].reg[1], v[1].reg[0] };
+    __m256i b[3] = { v[1].reg[1], v[2].reg[0], v[2].reg[1] };
+    transpose8x3(a);
+    transpose8x3(b);
+
+    for (uint32_t i = 0; i < 3; i++) {
+        v[i] = { a[i], b[i] };
+    }
+}
+
+// Calculate coarse partial derivatives for a 4x4 fragment.
+// https://gamedev.stackexchange.com/a/130933
+inline VFloat dFdx(VFloat p) {
+    VFloat a = { _mm256_shuffle_ps(p.reg[0], p.reg[0], 0b10'10'00'00), _mm256_shuffle_ps(p.reg[1], p.reg[1], 0b10'10'00'00) };  //[0 0 2 2]
+    VFloat b = { _mm256_shuffle_ps(p.reg[0], p.reg[0], 0b11'11'01'01), _mm256_shuffle_ps(p.reg[1], p.reg[1], 0b11'11'01'01) };  //[1 1 3 3]
+    return b - a;
+}
+inline VFloat dFdy(VFloat p) {
+    VFloat a = { _mm256_permute2f128_ps(p.reg[0], p.reg[0], 0x00), _mm256_permute2f128_ps(p.reg[1], p.reg[1], 0x00) };  // dupe lower 128 lanes
+    VFloat b = { _mm256_permute2f128_ps(p.reg[0], p.reg[0], 0x11), _mm256_permute2f128_ps(p.reg[1], p.reg[1], 0x11) };  // dupe upper 128 lanes
+    return b - a;
+}
+
+};  // namespace simd
+
+#undef _SIMD_BINOP
+#undef _SIMD_CMPOP
+
+};  // namespace swr
@@ -0,0 +1,261 @@
+#pragma once
+
+// AVX-512 backend: one 16-lane register per vector, masks map directly to k-registers.
+// Requires F + BW + DQ + VL (Skylake-X and later, Zen 4).
+// Included by SIMD.h, don't include this directly.
+
+namespace swr::inline SWR_ISA_NS {
+
+struct VInt {
+    static const uint32_t Length = sizeof(__m512i) / sizeof(int32_t);
+
+    __m512i reg;
+
+    VInt() { reg = _mm512_setzero_epi32(); }
+    VInt(__m512i x) { reg = x; }
+    VInt(int32_t x) { reg = _mm512_set1_epi32(x); }
+    inline operator __m512i() const { return reg; }
+
+    inline int32_t& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((int32_t*)&reg)[idx];
+    }
+
+    static inline VInt load(const void* ptr) { return _mm512_loadu_si512((__m512i*)ptr); }
+    inline void store(void* ptr) const { _mm512_storeu_si512((__m512i*)ptr, reg); }
+    inline void store(void* ptr, VMask mask) const { _mm512_mask_storeu_epi32(ptr, mask, reg); }
+
+    // Non-temporal store, `ptr` must be aligned to 64 bytes.
+    inline void stream(void* ptr) const { _mm512_stream_si512((__m512i*)ptr, reg); }
+
+    // Zero-extending loads of 16 packed bytes/shorts.
+    static inline VInt load_u8(const void* ptr) { return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)ptr)); }
+    static inline VInt load_u16(const void* ptr) { return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)ptr)); }
+    // Truncating store of the low byte of each lane.
+#ifdef __AVX512VBMI__
+    // vpermb is a single uop, vpmovdb is two.
+    inline void store_u8(void* ptr) const {
+        auto idx = _mm512_castsi128_si512(_mm_setr_epi32(0x0C'08'04'00, 0x1C'18'14'10, 0x2C'28'24'20, 0x3C'38'34'30));
+        _mm_storeu_si128((__m128i*)ptr, _mm512_castsi512_si128(_mm512_permutexvar_epi8(idx, reg)));
+    }
+#else
+    inline void store_u8(void* ptr) const { _mm_storeu_si128((__m128i*)ptr, _mm512_cvtepi32_epi8(reg)); }
+#endif
+
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices) { return _mm512_i32gather_epi32(indices, basePtr, IndexScale); }
+
+    // Gathers active lanes and takes `fallback` for the others. Inactive lanes are not accessed.
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices, VMask mask, VInt fallback) {
+        return _mm512_mask_i32gather_epi32(fallback, mask, indices, basePtr, IndexScale);
+    }
+
+    static inline VInt ramp() { return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+};
+struct VFloat {
+    static const uint32_t Length = sizeof(__m512) / sizeof(float);
+
+    __m512 reg;
+
+    VFloat() { reg = _mm512_setzero_ps(); }
+    VFloat(__m512 x) { reg = x; }
+    VFloat(float x) { reg = _mm512_set1_ps(x); }
+    inline operator __m512() const { return reg; }
+
+    inline float& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((float*)&reg)[idx];
+    }
+
+    static inline VFloat load(const void* ptr) { return _mm512_loadu_ps(ptr); }
+    inline void store(void* ptr) const { _mm512_storeu_ps(ptr, reg); }
+    inline void store(void* ptr, VMask mask) const { _mm512_mask_storeu_ps(ptr, mask, reg); }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices) { return _mm512_i32gather_ps(indices.reg, basePtr, IndexScale); }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices, VMask mask, VFloat fallback) {
+        return _mm512_mask_i32gather_ps(fallback, mask, indices, basePtr, IndexScale);
+    }
+
+    static inline VFloat ramp() { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+};
+
+#define _SIMD_DEF_OPERATORS(V, OpSuffix, MulOp, BitSuffix)                                          \
+    inline V operator+(V a, V b) { return _mm512_add_##OpSuffix(a, b); }                            \
+    inline V operator-(V a, V b) { return _mm512_sub_##OpSuffix(a, b); }                            \
+    inline V operator*(V a, V b) { return _mm512_##MulOp(a, b); }                                   \
+    inline V operator&(V a, V b) { return _mm512_and_##BitSuffix(a, b); }                           \
+    inline V operator|(V a, V b) { return _mm512_or_##BitSuffix(a, b); }                            \
+    inline V operator^(V a, V b) { return _mm512_xor_##BitSuffix(a, b); }                           \
+                                                                                                    \
+    inline V operator+=(V& a, V b) { return a = (a + b); }                                          \
+    inline V operator-=(V& a, V b) { return a = (a - b); }                                          \
+    inline V operator*=(V& a, V b) { return a = (a * b); }                                          \
+                                                                                                    \
+    inline VMask operator<(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_LT); }  \
+    inline VMask operator>(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_GT); }  \
+    inline VMask operator<=(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_LE); } \
+    inline VMask operator>=(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_GE); } \
+    inline VMask operator==(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_EQ); } \
+    inline VMask operator!=(V a, V b) { return _mm512_cmp_##OpSuffix##_mask(a, b, _MM_CMPINT_NE); }
+
+_SIMD_DEF_OPERATORS(VFloat, ps, mul_ps, ps);
+inline VFloat operator/(VFloat a, VFloat b) { return _mm512_div_ps(a, b); }
+inline VFloat operator-(VFloat a) { return a ^ -0.0f; }
+
+_SIMD_DEF_OPERATORS(VInt, epi32, mullo_epi32, si512);
+inline VInt operator>>(VInt a, uint32_t b) { return _mm512_srai_epi32(a, b); }
+inline VInt operator<<(VInt a, uint32_t b) { return _mm512_slli_epi32(a, b); }
+
+inline VInt operator>>(VInt a, VInt b) { return _mm512_srav_epi32(a, b); }
+inline VInt operator<<(VInt a, VInt b) { return _mm512_sllv_epi32(a, b); }
+
+#undef _SIMD_DEF_OPERATORS
+
+namespace simd {
+
+inline VInt round2i(VFloat x) { return _mm512_cvtps_epi32(x.reg); }
+inline VInt trunc2i(VFloat x) { return _mm512_cvttps_epi32(x.reg); }
+inline VFloat conv2f(VInt x) { return _mm512_cvtepi32_ps(x.reg); }
+
+inline VInt re2i(VFloat x) { return _mm512_castps_si512(x); }  // reinterpret float bits to int
+inline VFloat re2f(VInt x) { return _mm512_castsi512_ps(x); }  // reinterpret int to float bits
+
+inline VInt min(VInt x, VInt y) { return _mm512_min_epi32(x, y); }
+inline VInt max(VInt x, VInt y) { return _mm512_max_epi32(x, y); }
+
+inline VFloat min(VFloat x, VFloat y) { return _mm512_min_ps(x, y); }
+inline VFloat max(VFloat x, VFloat y) { return _mm512_max_ps(x, y); }
+
+//x * y + z
+inline VFloat fma(VFloat x, VFloat y, VFloat z) { return _mm512_fmadd_ps(x, y, z); }
+//x * y - z
+inline VFloat fms(VFloat x, VFloat y, VFloat z) { return _mm512_fmsub_ps(x, y, z); }
+
+// Linear interpolation between `a` and `b`: `a*(1-t) + b*t`
+// https://fgiesen.wordpress.com/2012/08/15/linear-interpolation-past-present-and-future/
+inline VFloat lerp(VFloat a, VFloat b, VFloat t) { return _mm512_fmadd_ps(t, b, _mm512_fnmadd_ps(t, a, a)); }
+
+inline VFloat sqrt(VFloat x) { return _mm512_sqrt_ps(x); }
+// approximate sqrt (14-bits precision)
+inline VFloat sqrt14(VFloat x) { return _mm512_mul_ps(_mm512_rsqrt14_ps(x), x); }
+// approximate reciprocal sqrt (14-bits precision)
+inline VFloat rsqrt14(VFloat x) { return _mm512_rsqrt14_ps(x); }
+// approximate reciprocal (14-bits precision)
+inline VFloat rcp14(VFloat x) { return _mm512_rcp14_ps(x); }
+
+inline VFloat abs(VFloat x) { return _mm512_abs_ps(x); }
+inline VInt abs(VInt x) { return _mm512_abs_epi32(x); }
+
+// lanewise: cond ? a : b
+inline VFloat csel(VMask cond, VFloat a, VFloat b) { return _mm512_mask_mov_ps(b, cond, a); }
+inline VInt csel(VMask cond, VInt a, VInt b) { return _mm512_mask_mov_epi32(b, cond, a); }
+
+// unsigned compares
+inline VMask ult(VInt a, VInt b) { return _mm512_cmplt_epu32_mask(a, b); }
+inline VMask uge(VInt a, VInt b) { return _mm512_cmpge_epu32_mask(a, b); }
+
+// 16-bit linear interpolation with 15-bit interpolant: a + (b - a) * t
+// mulhrs(a, b) = (a * b + (1 << 14)) >> 15
+inline VInt lerp16(VInt a, VInt b, VInt t) { return _mm512_add_epi16(a, _mm512_mulhrs_epi16(_mm512_sub_epi16(b, a), t)); }
+
+// Per-byte unsigned min/max and saturating add
+inline VInt min_u8(VInt a, VInt b) { return _mm512_min_epu8(a, b); }
+inline VInt max_u8(VInt a, VInt b) { return _mm512_max_epu8(a, b); }
+inline VInt adds_u8(VInt a, VInt b) { return _mm512_adds_epu8(a, b); }
+
+// shift right logical
+inline VInt shrl(VInt a, uint32_t b) { return _mm512_srli_epi32(a, b); }
+inline VInt shrl(VInt a, VInt b) { return _mm512_srlv_epi32(a, b); }
+
+// Lanewise table lookup: table[idx & 15]
+inline VInt permute(VInt table, VInt idx) { return _mm512_permutexvar_epi32(idx, table); }
+inline VFloat permute(VFloat table, VInt idx) { return _mm512_permutexvar_ps(idx, table); }
+// Lanewise lookup into a 32-entry table: concat(lo, hi)[idx & 31]
+inline VInt permute2(VInt lo, VInt hi, VInt idx) { return _mm512_permutex2var_epi32(lo, idx, hi); }
+
+// Converts the low 16 bits of each lane from half to single precision
+inline VFloat f16tof32(VInt x) { return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(x)); }
+// Converts to half precision, zero-extended to 32 bits
+inline VInt f32tof16(VFloat x) {
+    return _mm512_cvtepu16_epi32(_mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+
+// Packs the low byte of each component with unsigned saturation: r | g << 8 | b << 16 | a << 24
+inline VInt pack_u8x4(VInt r, VInt g, VInt b, VInt a) {
+    auto rg = _mm512_packs_epi32(r, g);
+    auto ba = _mm512_packs_epi32(b, a);
+    auto cb = _mm512_packus_epi16(rg, ba);
+
+    auto shuffMask = _mm512_setr4_epi32(0x0C'08'04'00, 0x0D'09'05'01, 0x0E'0A'06'02, 0x0F'0B'07'03);  // 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+    return _mm512_shuffle_epi8(cb, shuffMask);
+}
+
+#ifdef __VAES__
+#define SWR_SIMD_HAS_HASH
+// aesenc costs 5c/1t, so this is quite a bit cheaper than the integer hash.
+// Lanes within each 128-bit block are mixed together, which is fine for noise.
+inline VInt hash(VInt x) { return _mm512_aesenc_epi128(x, _mm512_set1_epi32(0)); }
+#endif
+
+// De-interleave vertex indices via 16x3 transpose - https://stackoverflow.com/a/45025712
+inline void transpose16x3(VInt v[3]) {
+
+    //   0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15
+    //  16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31
+    //  32 33 34 35 36 37 38 39 40 41 42 43 44 45 46 47
+
+    __m512i a0, a1, a2, r0, r1, r2;
+
+    a0 = _mm512_shuffle_i64x2(v[0], v[1], _MM_SHUFFLE(3, 2, 1, 0));
+    a1 = _mm512_shuffle_i64x2(v[0], v[2], _MM_SHUFFLE(1, 0, 3, 2));
+    a2 = _mm512_shuffle_i64x2(v[1], v[2], _MM_SHUFFLE(3, 2, 1, 0));
+
+    //   0  1  2  3  4  5  6  7 24 25 26 27 28 29 30 31
+    //   8  9 10 11 12 13 14 15 32 33 34 35 36 37 38 39
+    //  16 17 18 19 20 21 22 23 40 41 42 43 44 45 46 47
+
+    r0 = _mm512_mask_blend_epi32(0xf0f0, a0, a1);
+    r1 = _mm512_permutex2var_epi32(a0, _mm512_setr_epi32(4, 5, 6, 7, 16, 17, 18, 19, 12, 13, 14, 15, 24, 25, 26, 27), a2);
+    r2 = _mm512_mask_blend_epi32(0xf0f0, a1, a2);
+
+    //   0  1  2  3 12 13 14 15 24 25 26 27 36 37 38 39
+    //   4  5  6  7 16 17 18 19 28 29 30 31 40 41 42 43
+    //   8  9 10 11 20 21 22 23 32 33 34 35 44 45 46 47
+
+    a0 = _mm512_mask_blend_epi32(0xcccc, r0, r1);
+    a1 = _mm512_castps_si512(_mm512_shuffle_ps(_mm512_castsi512_ps(r0), _mm512_castsi512_ps(r2), 78));
+    a2 = _mm512_mask_blend_epi32(0xcccc, r1, r2);
+
+    //   0  1  6  7 12 13 18 19 24 25 30 31 36 37 42 43
+    //   2  3  8  9 14 15 20 21 26 27 32 33 38 39 44 45
+    //   4  5 10 11 16 17 22 23 28 29 34 35 40 41 46 47
+
+    v[0] = _mm512_mask_blend_epi32(0xaaaa, a0, a1);
+    v[1] = _mm512_permutex2var_epi32(a0, _mm512_setr_epi32(1, 16, 3, 18, 5, 20, 7, 22, 9, 24, 11, 26, 13, 28, 15, 30), a2);
+    v[2] = _mm512_mask_blend_epi32(0xaaaa, a1, a2);
+
+    //   0  3  6  9 12 15 18 21 24 27 30 33 36 39 42 45
+    //   1  4  7 10 13 16 19 22 25 28 31 34 37 40 43 46
+    //   2  5  8 11 14 17 20 23 26 29 32 35 38 41 44 47
+}
+
+// Calculate coarse partial derivatives for a 4x4 fragment.
+// https://gamedev.stackexchange.com/a/130933
+inline VFloat dFdx(VFloat p) {
+    auto a = _mm512_shuffle_ps(p, p, 0b10'10'00'00);  //[0 0 2 2]
+    auto b = _mm512_shuffle_ps(p, p, 0b11'11'01'01);  //[1 1 3 3]
+    return _mm512_sub_ps(b, a);
+}
+inline VFloat dFdy(VFloat p) {
+    auto a = _mm512_shuffle_f32x4(p, p, 0b10'10'00'00);
+    auto b = _mm512_shuffle_f32x4(p, p, 0b11'11'01'01);
+    return _mm512_sub_ps(b, a);
+}
+
+};  // namespace simd
+
+};  // namespace swr
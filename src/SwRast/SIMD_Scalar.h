@@ -0,0 +1,343 @@
+#pragma once
+
+// Scalar reference backend: plain 16-element arrays, one loop per op.
+// Meant for validating the vector backends and as a fallback for CPUs without AVX2.
+// Results should match the other backends except for approximations (rcp14/rsqrt14 are exact here),
+// and the lane mixing of the aesenc hash.
+// Included by SIMD.h, don't include this directly.
+
+#include <algorithm>
+#include <cmath>
+
+namespace swr::inline SWR_ISA_NS {
+
+struct alignas(64) VInt {
+    static const uint32_t Length = 16;
+
+    int32_t reg[Length];
+
+    VInt() { std::fill_n(reg, Length, 0); }
+    VInt(int32_t x) { std::fill_n(reg, Length, x); }
+
+    inline int32_t& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((int32_t*)&reg)[idx];
+    }
+
+    static inline VInt load(const void* ptr) {
+        VInt r;
+        std::memcpy(r.reg, ptr, sizeof(reg));
+        return r;
+    }
+    inline void store(void* ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+    inline void store(void* ptr, VMask mask) const {
+        for (uint32_t i : BitIter(mask)) {
+            ((int32_t*)ptr)[i] = reg[i];
+        }
+    }
+    inline void stream(void* ptr) const { store(ptr); }
+
+    // Zero-extending loads of 16 packed bytes/shorts.
+    static inline VInt load_u8(const void* ptr) {
+        VInt r;
+        for (uint32_t i = 0; i < Length; i++) r.reg[i] = ((const uint8_t*)ptr)[i];
+        return r;
+    }
+    static inline VInt load_u16(const void* ptr) {
+        VInt r;
+        for (uint32_t i = 0; i < Length; i++) r.reg[i] = ((const uint16_t*)ptr)[i];
+        return r;
+    }
+    // Truncating store of the low byte of each lane.
+    inline void store_u8(void* ptr) const {
+        for (uint32_t i = 0; i < Length; i++) ((uint8_t*)ptr)[i] = (uint8_t)reg[i];
+    }
+
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices) {
+        return gather<IndexScale>(basePtr, indices, 0xFFFF, 0);
+    }
+
+    // Gathers active lanes and takes `fallback` for the others. Inactive lanes are not accessed.
+    template<int IndexScale = 1>
+    static inline VInt gather(const void* basePtr, VInt indices, VMask mask, VInt fallback) {
+        for (uint32_t i : BitIter(mask)) {
+            std::memcpy(&fallback.reg[i], (const uint8_t*)basePtr + (intptr_t)indices.reg[i] * IndexScale, 4);
+        }
+        return fallback;
+    }
+
+    static inline VInt ramp() {
+        VInt r;
+        for (uint32_t i = 0; i < Length; i++) r.reg[i] = (int32_t)i;
+        return r;
+    }
+};
+struct alignas(64) VFloat {
+    static const uint32_t Length = 16;
+
+    float reg[Length];
+
+    VFloat() { std::fill_n(reg, Length, 0.0f); }
+    VFloat(float x) { std::fill_n(reg, Length, x); }
+
+    inline float& operator[](size_t idx) const {
+        assert(idx >= 0 && idx < Length);
+        return ((float*)&reg)[idx];
+    }
+
+    static inline VFloat load(const void* ptr) {
+        VFloat r;
+        std::memcpy(r.reg, ptr, sizeof(reg));
+        return r;
+    }
+    inline void store(void* ptr) const { std::memcpy(ptr, reg, sizeof(reg)); }
+    inline void store(void* ptr, VMask mask) const {
+        for (uint32_t i : BitIter(mask)) {
+            ((float*)ptr)[i] = reg[i];
+        }
+    }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices) {
+        return gather<IndexScale>(basePtr, indices, 0xFFFF, 0.0f);
+    }
+
+    template<int IndexScale = 1>
+    static inline VFloat gather(const void* basePtr, VInt indices, VMask mask, VFloat fallback) {
+        for (uint32_t i : BitIter(mask)) {
+            std::memcpy(&fallback.reg[i], (const uint8_t*)basePtr + (intptr_t)indices.reg[i] * IndexScale, 4);
+        }
+        return fallback;
+    }
+
+    static inline VFloat ramp() {
+        VFloat r;
+        for (uint32_t i = 0; i < Length; i++) r.reg[i] = (float)i;
+        return r;
+    }
+};
+
+// Evaluates `Expr` for each lane index `i`, writing into a new `R`.
+#define _SIMD_LANEWISE(R, Expr)                       \
+    R r;                                              \
+    for (uint32_t i = 0; i < R::Length; i++) {        \
+        r.reg[i] = Expr;                              \
+    }                                                 \
+    return r;
+#define _SIMD_CMPWISE(Expr)                           \
+    VMask r = 0;                                      \
+    for (uint32_t i = 0; i < 16; i++) {               \
+        r |= (VMask)((Expr) ? 1 << i : 0);            \
+    }                                                 \
+    return r;
+
+#define _SIMD_DEF_COMPARES(V)                                                            \
+    inline VMask operator<(V a, V b) { _SIMD_CMPWISE(a.reg[i] < b.reg[i]) }              \
+    inline VMask operator>(V a, V b) { _SIMD_CMPWISE(a.reg[i] > b.reg[i]) }              \
+    inline VMask operator<=(V a, V b) { _SIMD_CMPWISE(a.reg[i] <= b.reg[i]) }            \
+    inline VMask operator>=(V a, V b) { _SIMD_CMPWISE(a.reg[i] >= b.reg[i]) }            \
+    inline VMask operator==(V a, V b) { _SIMD_CMPWISE(a.reg[i] == b.reg[i]) }            \
+    inline VMask operator!=(V a, V b) { _SIMD_CMPWISE(a.reg[i] != b.reg[i]) }            \
+                                                                                         \
+    inline V operator+=(V& a, V b) { return a = (a + b); }                               \
+    inline V operator-=(V& a, V b) { return a = (a - b); }                               \
+    inline V operator*=(V& a, V b) { return a = (a * b); }
+
+namespace simd::detail {
+
+inline uint32_t AsU32(float x) { return std::bit_cast<uint32_t>(x); }
+inline float AsF32(uint32_t x) { return std::bit_cast<float>(x); }
+
+};  // namespace simd::detail
+
+inline VFloat operator+(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, a.reg[i] + b.reg[i]) }
+inline VFloat operator-(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, a.reg[i] - b.reg[i]) }
+inline VFloat operator*(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, a.reg[i] * b.reg[i]) }
+inline VFloat operator/(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, a.reg[i] / b.reg[i]) }
+inline VFloat operator&(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, simd::detail::AsF32(simd::detail::AsU32(a.reg[i]) & simd::detail::AsU32(b.reg[i]))) }
+inline VFloat operator|(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, simd::detail::AsF32(simd::detail::AsU32(a.reg[i]) | simd::detail::AsU32(b.reg[i]))) }
+inline VFloat operator^(VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, simd::detail::AsF32(simd::detail::AsU32(a.reg[i]) ^ simd::detail::AsU32(b.reg[i]))) }
+inline VFloat operator-(VFloat a) { return a ^ -0.0f; }
+_SIMD_DEF_COMPARES(VFloat);
+
+// Arithmetic is done in unsigned to get wrap-around like the vector backends.
+inline VInt operator+(VInt a, VInt b) { _SIMD_LANEWISE(VInt, (int32_t)((uint32_t)a.reg[i] + (uint32_t)b.reg[i])) }
+inline VInt operator-(VInt a, VInt b) { _SIMD_LANEWISE(VInt, (int32_t)((uint32_t)a.reg[i] - (uint32_t)b.reg[i])) }
+inline VInt operator*(VInt a, VInt b) { _SIMD_LANEWISE(VInt, (int32_t)((uint32_t)a.reg[i] * (uint32_t)b.reg[i])) }
+inline VInt operator&(VInt a, VInt b) { _SIMD_LANEWISE(VInt, a.reg[i] & b.reg[i]) }
+inline VInt operator|(VInt a, VInt b) { _SIMD_LANEWISE(VInt, a.reg[i] | b.reg[i]) }
+inline VInt operator^(VInt a, VInt b) { _SIMD_LANEWISE(VInt, a.reg[i] ^ b.reg[i]) }
+_SIMD_DEF_COMPARES(VInt);
+
+// Shifts by 32 or more give 0 (or the sign for >>), same as the x86 variable shifts.
+inline VInt operator>>(VInt a, VInt b) { _SIMD_LANEWISE(VInt, a.reg[i] >> std::min((uint32_t)b.reg[i], 31u)) }
+inline VInt operator<<(VInt a, VInt b) { _SIMD_LANEWISE(VInt, (uint32_t)b.reg[i] < 32 ? (int32_t)((uint32_t)a.reg[i] << b.reg[i]) : 0) }
+
+inline VInt operator>>(VInt a, uint32_t b) { return a >> VInt((int32_t)b); }
+inline VInt operator<<(VInt a, uint32_t b) { return a << VInt((int32_t)b); }
+
+#undef _SIMD_DEF_COMPARES
+
+namespace simd {
+
+inline VInt round2i(VFloat x) { _SIMD_LANEWISE(VInt, (int32_t)std::nearbyint(x.reg[i])) }
+inline VInt trunc2i(VFloat x) { _SIMD_LANEWISE(VInt, (int32_t)x.reg[i]) }
+inline VFloat conv2f(VInt x) { _SIMD_LANEWISE(VFloat, (float)x.reg[i]) }
+
+inline VInt re2i(VFloat x) { _SIMD_LANEWISE(VInt, (int32_t)detail::AsU32(x.reg[i])) }  // reinterpret float bits to int
+inline VFloat re2f(VInt x) { _SIMD_LANEWISE(VFloat, detail::AsF32((uint32_t)x.reg[i])) }  // reinterpret int to float bits
+
+inline VInt min(VInt x, VInt y) { _SIMD_LANEWISE(VInt, std::min(x.reg[i], y.reg[i])) }
+inline VInt max(VInt x, VInt y) { _SIMD_LANEWISE(VInt, std::max(x.reg[i], y.reg[i])) }
+
+// Same operand order as minps/maxps: returns y if either is NaN.
+inline VFloat min(VFloat x, VFloat y) { _SIMD_LANEWISE(VFloat, x.reg[i] < y.reg[i] ? x.reg[i] : y.reg[i]) }
+inline VFloat max(VFloat x, VFloat y) { _SIMD_LANEWISE(VFloat, x.reg[i] > y.reg[i] ? x.reg[i] : y.reg[i]) }
+
+//x * y + z
+inline VFloat fma(VFloat x, VFloat y, VFloat z) { _SIMD_LANEWISE(VFloat, std::fma(x.reg[i], y.reg[i], z.reg[i])) }
+//x * y - z
+inline VFloat fms(VFloat x, VFloat y, VFloat z) { _SIMD_LANEWISE(VFloat, std::fma(x.reg[i], y.reg[i], -z.reg[i])) }
+
+// Linear interpolation between `a` and `b`: `a*(1-t) + b*t`
+// https://fgiesen.wordpress.com/2012/08/15/linear-interpolation-past-present-and-future/
+inline VFloat lerp(VFloat a, VFloat b, VFloat t) { _SIMD_LANEWISE(VFloat, std::fma(t.reg[i], b.reg[i], std::fma(-t.reg[i], a.reg[i], a.reg[i]))) }
+
+inline VFloat sqrt(VFloat x) { _SIMD_LANEWISE(VFloat, std::sqrt(x.reg[i])) }
+// "approximate" sqrt (exact on this backend)
+inline VFloat sqrt14(VFloat x) { return sqrt(x); }
+// "approximate" reciprocal sqrt (exact on this backend)
+inline VFloat rsqrt14(VFloat x) { _SIMD_LANEWISE(VFloat, 1.0f / std::sqrt(x.reg[i])) }
+// "approximate" reciprocal (exact on this backend)
+inline VFloat rcp14(VFloat x) { return 1.0f / x; }
+
+inline VFloat abs(VFloat x) { _SIMD_LANEWISE(VFloat, std::abs(x.reg[i])) }
+inline VInt abs(VInt x) { _SIMD_LANEWISE(VInt, (int32_t)(x.reg[i] < 0 ? 0u - (uint32_t)x.reg[i] : (uint32_t)x.reg[i])) }
+
+// lanewise: cond ? a : b
+inline VFloat csel(VMask cond, VFloat a, VFloat b) { _SIMD_LANEWISE(VFloat, (cond >> i & 1) ? a.reg[i] : b.reg[i]) }
+inline VInt csel(VMask cond, VInt a, VInt b) { _SIMD_LANEWISE(VInt, (cond >> i & 1) ? a.reg[i] : b.reg[i]) }
+
+// unsigned compares
+inline VMask ult(VInt a, VInt b) { _SIMD_CMPWISE((uint32_t)a.reg[i] < (uint32_t)b.reg[i]) }
+inline VMask uge(VInt a, VInt b) { _SIMD_CMPWISE((uint32_t)a.reg[i] >= (uint32_t)b.reg[i]) }
+
+namespace detail {
+
+// Applies `fn` on each of the 16-bit/8-bit elements of `a` and `b`
+template<typename T, typename F>
+inline VInt ForEachPacked(VInt a, VInt b, F fn) {
+    const uint32_t Count = sizeof(VInt::reg) / sizeof(T);
+    T pa[Count], pb[Count], pr[Count];
+    std::memcpy(pa, a.reg, sizeof(pa));
+    std::memcpy(pb, b.reg, sizeof(pb));
+
+    for (uint32_t i = 0; i < Count; i++) {
+        pr[i] = fn(pa[i], pb[i]);
+    }
+    VInt r;
+    std::memcpy(r.reg, pr, sizeof(pr));
+    return r;
+}
+
+};  // namespace detail
+
+// 16-bit linear interpolation with 15-bit interpolant: a + (b - a) * t
+// mulhrs(a, b) = (a * b + (1 << 14)) >> 15
+inline VInt lerp16(VInt a, VInt b, VInt t) {
+    VInt d = detail::ForEachPacked<int16_t>(b, a, [](int16_t x, int16_t y) { return (int16_t)(x - y); });
+    VInt m = detail::ForEachPacked<int16_t>(d, t, [](int16_t x, int16_t y) { return (int16_t)((x * y + (1 << 14)) >> 15); });
+    return detail::ForEachPacked<int16_t>(a, m, [](int16_t x, int16_t y) { return (int16_t)(x + y); });
+}
+
+// Per-byte unsigned min/max and saturating add
+inline VInt min_u8(VInt a, VInt b) { return detail::ForEachPacked<uint8_t>(a, b, [](uint8_t x, uint8_t y) { return std::min(x, y); }); }
+inline VInt max_u8(VInt a, VInt b) { return detail::ForEachPacked<uint8_t>(a, b, [](uint8_t x, uint8_t y) { return std::max(x, y); }); }
+inline VInt adds_u8(VInt a, VInt b) {
+    return detail::ForEachPacked<uint8_t>(a, b, [](uint8_t x, uint8_t y) { return (uint8_t)std::min(x + y, 255); });
+}
+
+// shift right logical
+inline VInt shrl(VInt a, VInt b) { _SIMD_LANEWISE(VInt, (uint32_t)b.reg[i] < 32 ? (int32_t)((uint32_t)a.reg[i] >> b.reg[i]) : 0) }
+inline VInt shrl(VInt a, uint32_t b) { return shrl(a, VInt((int32_t)b)); }
+
+// Lanewise table lookup: table[idx & 15]
+inline VInt permute(VInt table, VInt idx) { _SIMD_LANEWISE(VInt, table.reg[idx.reg[i] & 15]) }
+inline VFloat permute(VFloat table, VInt idx) { _SIMD_LANEWISE(VFloat, table.reg[idx.reg[i] & 15]) }
+// Lanewise lookup into a 32-entry table: concat(lo, hi)[idx & 31]
+inline VInt permute2(VInt lo, VInt hi, VInt idx) { _SIMD_LANEWISE(VInt, (idx.reg[i] & 16) ? hi.reg[idx.reg[i] & 15] : lo.reg[idx.reg[i] & 15]) }
+
+namespace detail {
+
+inline float HalfToFloat(uint32_t h) {
+    uint32_t sign = (h & 0x8000) << 16, exp = (h >> 10) & 31, mant = h & 0x3FF;
+
+    if (exp == 31) return AsF32(sign | 0x7F800000 | mant << 13);  // inf/nan
+    if (exp == 0) return AsF32(sign | AsU32((float)mant * (1.0f / (1 << 24))));  // denormal
+    return AsF32(sign | (exp + 112) << 23 | mant << 13);
+}
+// Round to nearest even, like vcvtps2ph
+inline uint32_t FloatToHalf(float f) {
+    uint32_t x = AsU32(f);
+    uint32_t sign = (x >> 16) & 0x8000, mant = x & 0x7FFFFF;
+    int32_t exp = (int32_t)((x >> 23) & 255) - 127 + 15;
+
+    if (((x >> 23) & 255) == 255) return sign | 0x7C00 | (mant != 0 ? 0x200 : 0);  // inf/nan
+    if (exp >= 31) return sign | 0x7C00;                                             // overflow
+    if (exp < -10) return sign;                                                      // underflow
+
+    uint32_t shift = 13, h = (uint32_t)exp << 10;
+    if (exp <= 0) {
+        mant |= 0x800000;
+        shift = (uint32_t)(14 - exp);
+        h = 0;
+    }
+    uint32_t rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+    h += mant >> shift;
+    // Carry into the exponent is fine, that's still the correct encoding.
+    if (rem > half || (rem == half && (h & 1))) h++;
+    return sign | h;
+}
+
+};  // namespace detail
+
+// Converts the low 16 bits of each lane from half to single precision
+inline VFloat f16tof32(VInt x) { _SIMD_LANEWISE(VFloat, detail::HalfToFloat((uint32_t)x.reg[i] & 0xFFFF)) }
+// Converts to half precision, zero-extended to 32 bits
+inline VInt f32tof16(VFloat x) { _SIMD_LANEWISE(VInt, (int32_t)detail::FloatToHalf(x.reg[i])) }
+
+// Packs the low byte of each component with unsigned saturation: r | g << 8 | b << 16 | a << 24
+inline VInt pack_u8x4(VInt r, VInt g, VInt b, VInt a) {
+    VInt res;
+    for (uint32_t i = 0; i < VInt::Length; i++) {
+        uint32_t cr = (uint32_t)std::clamp(r.reg[i], 0, 255);
+        uint32_t cg = (uint32_t)std::clamp(g.reg[i], 0, 255);
+        uint32_t cb = (uint32_t)std::clamp(b.reg[i], 0, 255);
+        uint32_t ca = (uint32_t)std::clamp(a.reg[i], 0, 255);
+        res.reg[i] = (int32_t)(cr | cg << 8 | cb << 16 | ca << 24);
+    }
+    return res;
+}
+
+// De-interleave 16 triplets
+inline void transpose16x3(VInt v[3]) {
+    int32_t src[48];
+    std::memcpy(src, v, sizeof(src));
+
+    for (uint32_t i = 0; i < 48; i++) {
+        v[i % 3].reg[i / 3] = src[i];
+    }
+}
+
+// Calculate coarse partial derivatives for a 4x4 fragment.
+// https://gamedev.stackexchange.com/a/130933
+inline VFloat dFdx(VFloat p) { _SIMD_LANEWISE(VFloat, p.reg[i | 1] - p.reg[i & ~1u]) }
+inline VFloat dFdy(VFloat p) { _SIMD_LANEWISE(VFloat, p.reg[i | 4] - p.reg[i & ~4u]) }
+
+};  // namespace simd
+
+#undef _SIMD_LANEWISE
+#undef _SIMD_CMPWISE
+
+};  // namespace swr
@@ -2,12 +2,13 @@
 
 #include <unordered_map>
 #include <filesystem>
+#include <stdexcept>
 
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 
-namespace scene {
+namespace scene::inline SWR_ISA_NS {
 
 static void PackNorm(int8_t* dst, float* src) {
     for (uint32_t i = 0; i < 3; i++) {
@@ -109,6 +110,14 @@ static swr::RgbaTexture2D* LoadTextures(Model& m, const aiMaterial* mat) {
     return &slot.first->second;
 }
 
+static bool HasAlphaCutouts(const swr::RgbaTexture2D& tex) {
+    // Layer 0, mip 0 is at the start of the texture data
+    for (uint32_t i = 0; i < tex.Width * tex.Height; i++) {
+        if ((tex.Data[i] >> 24) < 128) return true;
+    }
+    return false;
+}
+
 Node ConvertNode(const Model& model, aiNode* node) {
     //TODO: figure out wtf is going on with empty nodes
     //FIXME: apply transform on node AABBs
@@ -150,7 +159,7 @@ Model::Model(std::string_view path) {
     const aiScene* scene = imp.ReadFile(path.data(), processFlags);
 
     if (!scene || !scene->HasMeshes()) {
-        throw std::exception("Could not import scene");
+        throw std::runtime_error("Could not import scene");
     }
 
     BasePath = std::filesystem::path(path).parent_path().string();
@@ -158,8 +167,11 @@ Model::Model(std::string_view path) {
     for (int i = 0; i < scene->mNumMaterials; i++) {
         aiMaterial* mat = scene->mMaterials[i];
 
+        swr::RgbaTexture2D* tex = LoadTextures(*this, mat);
+
         Materials.push_back(Material{
-            .Texture = LoadTextures(*this, mat),
+            .Texture = tex,
+            .AlphaTested = HasAlphaCutouts(*tex),
         });
     }
 
@@ -185,6 +197,7 @@ Model::Model(std::string_view path) {
 
         Mesh& impMesh = Meshes.emplace_back(Mesh{
             .VertexOffset = vertexPos,
+            .VertexCount = mesh->mNumVertices,
             .IndexOffset = indexPos,
             .Material = &Materials[mesh->mMaterialIndex],
             .BoundMin = glm::vec3(INFINITY),
@@ -294,20 +307,21 @@ bool DepthPyramid::IsVisible(const Mesh& mesh, const glm::mat4& transform) const
 }
 
 void DepthPyramid::Update(const swr::Framebuffer& fb, const glm::mat4& viewProj) {
+    using namespace swr;
     EnsureStorage(fb.Width, fb.Height);
 
     // Downsample original depth buffer
     for (uint32_t y = 0; y < fb.Height; y += 4) {
         for (uint32_t x = 0; x < fb.Width; x += 4) {
-            auto tile = _mm512_load_ps(&fb.DepthBuffer[fb.GetPixelOffset(x, y)]);
-            // A B C D  ->  max(AC, BD)
-            tile = _mm512_shuffle_f32x4(tile, tile, _MM_SHUFFLE(3, 1, 2, 0));
-            auto rows = _mm256_max_ps(_mm512_extractf32x8_ps(tile, 0), _mm512_extractf32x8_ps(tile, 1));
-            auto cols = _mm256_max_ps(rows, _mm256_movehdup_ps(rows));
-            cols = _mm256_permutevar8x32_ps(cols, _mm256_setr_epi32(0, 2, -1, -1, 4, 6, -1, -1));
-
-            _mm_storel_pi((__m64*)&_storage[(x / 2) + (y / 2 + 0) * _width], _mm256_extractf128_ps(cols, 0));
-            _mm_storel_pi((__m64*)&_storage[(x / 2) + (y / 2 + 1) * _width], _mm256_extractf128_ps(cols, 1));
+            VFloat tile = VFloat::load(&fb.DepthBuffer[fb.GetPixelOffset(x, y)]);
+            // Reduce 2x2 quads: max with horizontal neighbor, then with vertical neighbor
+            tile = simd::max(tile, simd::permute(tile, VInt::ramp() ^ 1));
+            tile = simd::max(tile, simd::permute(tile, VInt::ramp() ^ 4));
+            // Compact quads at [0 2 8 10] into [0 1 2 3]
+            VFloat res = simd::permute(tile, (VInt::ramp() & 1) * 2 + (VInt::ramp() & 2) * 4);
+
+            res.store(&_storage[(x / 2) + (y / 2 + 0) * _width], 0b0011);
+            simd::permute(res, VInt::ramp() + 2).store(&_storage[(x / 2) + (y / 2 + 1) * _width], 0b0011);
         }
     }
 
@@ -321,13 +335,13 @@ void DepthPyramid::Update(const swr::Framebuffer& fb, const glm::mat4& viewProj)
         // TODO: edge clamping and stuff
         for (uint32_t y = 0; y < h; y += 2) {
             for (uint32_t x = 0; x < w; x += 16) {
-                auto rows = _mm512_max_ps(_mm512_loadu_ps(&src[x + (y + 0) * w]), 
-                                          _mm512_loadu_ps(&src[x + (y + 1) * w]));
+                VFloat rows = simd::max(VFloat::load(&src[x + (y + 0) * w]),
+                                        VFloat::load(&src[x + (y + 1) * w]));
 
-                auto cols = _mm512_max_ps(rows, _mm512_movehdup_ps(rows));
-                auto res = _mm512_permutexvar_ps(_mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1), cols);
+                VFloat cols = simd::max(rows, simd::permute(rows, VInt::ramp() | 1));
+                VFloat res = simd::permute(cols, VInt::ramp() * 2);
 
-                _mm256_storeu_ps(&dst[(x / 2) + (y / 2) * (w / 2)], _mm512_extractf32x8_ps(res, 0));
+                res.store(&dst[(x / 2) + (y / 2) * (w / 2)], 0x00FF);
             }
         }
     }
@@ -8,17 +8,18 @@
 #include "SwRast.h"
 #include "Texture.h"
 
-namespace scene {
+namespace scene::inline SWR_ISA_NS {
 
 struct Material {
     // Layer 0: BaseColor
     // Layer 1?: Normal (XY), Metallic (Z), Roughness (W)
     // Layer 2?: Emissive, BaseColor.A==255 is a mask for non-zero emission. Normal values range between [0..254]
     const swr::RgbaTexture2D* Texture;
+    bool AlphaTested;  // BaseColor has texels with A < 128, which are discarded by the surface shader
 };
 
 struct Mesh {
-    uint32_t VertexOffset, IndexOffset, IndexCount;
+    uint32_t VertexOffset, VertexCount, IndexOffset, IndexCount;
     Material* Material;
     glm::vec3 BoundMin, BoundMax;
 };
@@ -103,10 +104,10 @@ public:
     }
     swr::VFloat __vectorcall SampleDepth(swr::VInt ix, swr::VInt iy, uint32_t level) const {
         ix = ix >> 1, iy = iy >> 1;
-        uint16_t boundMask = _mm512_cmplt_epu32_mask(ix, swr::VInt((int32_t)_width)) & _mm512_cmplt_epu32_mask(iy, swr::VInt((int32_t)_height));
+        swr::VMask boundMask = swr::simd::ult(ix, (int32_t)_width) & swr::simd::ult(iy, (int32_t)_height);
         swr::VInt indices = (ix >> level) + (iy >> level) * (int32_t)(_width >> level);
 
-        return _mm512_mask_i32gather_ps(_mm512_set1_ps(1.0f), boundMask, indices, &_storage[_offsets[level]], 4);
+        return swr::VFloat::gather<4>(&_storage[_offsets[level]], indices, boundMask, 1.0f);
     }
 };
 
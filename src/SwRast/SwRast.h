@@ -1,73 +1,184 @@
 #pragma once
 
+#include <atomic>
+#include <bit>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <span>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "SIMD.h"
 #include "ProfilerStats.h"
+#include "ThreadPool.h"
 
-namespace swr {
+namespace swr::inline SWR_ISA_NS {
 
 // Pixel offsets within a 4x4 tile/fragment
 //   X: [0,1,2,3, 0,1,2,3, ...]
 //   Y: [0,0,0,0, 1,1,1,1, ...]
-inline const VInt FragPixelOffsetsX = VInt::ramp() & 3, FragPixelOffsetsY = VInt::ramp() >> 2;
+// These are functions rather than globals because dynamic initializers run at startup,
+// before the ISA dispatcher had a chance to check whether the instructions are supported.
+inline VInt FragPixelOffsetsX() { return VInt::ramp() & 3; }
+inline VInt FragPixelOffsetsY() { return VInt::ramp() >> 2; }
 
 struct Framebuffer {
     //Data is stored in tiles of 4x4 so that rasterizer writes are cheap.
     static const uint32_t TileSize = 4, TileShift = 2, TileMask = TileSize - 1, TileNumPixels = TileSize * TileSize;
+    static const uint32_t CoarseBlockShift = 4;
+    // Tiles are further grouped in bins of 128x128 pixels, the largest rasterizer bin size (smaller ones subdivide them),
+    // so that the pixels touched by a bin are contiguous in memory (64KB for depth) rather than spread over 128 rows.
+    static const uint32_t BinShift = 7, BinSize = 1 << BinShift, BinNumPixels = BinSize * BinSize;
+    static const uint32_t BinTileShift = BinShift - TileShift, BinTileMask = (1 << BinTileShift) - 1;
+
+    // Describes an extra per-pixel buffer, e.g. for a G-Buffer channel.
+    // Full resolution attachments use the same tiled layout as the color buffer, downscaled ones are
+    // laid out by their users.
+    struct AttachmentDesc {
+        uint32_t BytesPerPixel;
+        uint32_t ScaleLog2 = 0;  // 0 = full resolution, 1 = half, 2 = quarter
+    };
+    struct Attachment : AttachmentDesc {
+        uint32_t Width, Height;  // Size in pixels, rounded up
+        size_t Offset;           // In bytes from the start of AttachmentBuffer
+    };
 
-    uint32_t Width, Height, TileStride;
-    uint32_t AttachmentStride, NumAttachments;
+    uint32_t Width, Height, BinStride;
+    uint32_t BufferSize;  // Number of pixels in the color, depth, and full resolution attachments, padded to whole bins
+    uint32_t CoarseStride;
     
     AlignedBuffer<uint32_t> ColorBuffer;
     AlignedBuffer<float> DepthBuffer;
-    AlignedBuffer<uint8_t> AttachmentBuffer;
-
-    Framebuffer(uint32_t width, uint32_t height, uint32_t numAttachments = 0) {
+    AlignedBuffer<uint8_t> AttachmentBuffer;  // Storage for all attachments
+    std::vector<Attachment> Attachments;
+
+    // Max depth of each tile, grouped in blocks of 16x16 pixels (4x4 tiles) so that the rasterizer can test
+    // all tiles in a block at once. Kept up to date by the rasterizer, values may be higher than actual depth.
+    AlignedBuffer<float> CoarseDepthBuffer;
+
+    // Clears only set a flag for each tile, which is filled with the clear value when the rasterizer first touches it.
+    // `Rasterizer::Flush()` fills the remaining ones, ResolveClears() must be called before reading the buffers otherwise.
+    static const uint8_t TileClearColor = 1, TileClearDepth = 2;
+    AlignedBuffer<uint8_t> TileClearFlags;
+    uint32_t ColorClearValue = 0;
+    float DepthClearValue = 1.0f;
+    bool HasPendingClears = false;
+
+    Framebuffer(uint32_t width, uint32_t height, std::span<const AttachmentDesc> attachments = {}) {
         Width = (width + TileMask) & ~TileMask;
         Height = (height + TileMask) & ~TileMask;
-        TileStride = Width / TileSize;
-        AttachmentStride = (Width * Height + 63) & ~63u;
-        NumAttachments = numAttachments;
+        BinStride = (Width + BinSize - 1) >> BinShift;
+        BufferSize = BinStride * ((Height + BinSize - 1) >> BinShift) * BinNumPixels;
+        CoarseStride = (Width + 15) >> CoarseBlockShift;
+
+        size_t attachmentSize = 0;
+
+        for (const AttachmentDesc& desc : attachments) {
+            Attachment& att = Attachments.emplace_back(Attachment{ desc });
+            att.Width = (Width + (1u << desc.ScaleLog2) - 1) >> desc.ScaleLog2;
+            att.Height = (Height + (1u << desc.ScaleLog2) - 1) >> desc.ScaleLog2;
+            att.Offset = attachmentSize;
+            size_t numPixels = desc.ScaleLog2 == 0 ? BufferSize : (size_t)att.Width * att.Height;
+            attachmentSize += (numPixels * desc.BytesPerPixel + 63) & ~(size_t)63;
+        }
 
-        ColorBuffer = alloc_buffer<uint32_t>(Width * Height);
-        DepthBuffer = alloc_buffer<float>(Width * Height);
-        AttachmentBuffer = alloc_buffer<uint8_t>(AttachmentStride * numAttachments);
+        ColorBuffer = alloc_buffer<uint32_t>(BufferSize, MemoryUsage::Framebuffer);
+        DepthBuffer = alloc_buffer<float>(BufferSize, MemoryUsage::Framebuffer);
+        AttachmentBuffer = alloc_buffer<uint8_t>(attachmentSize, MemoryUsage::Framebuffer);
+        CoarseDepthBuffer = alloc_buffer<float>(GetCoarseDepthSize(), MemoryUsage::Framebuffer);
+        TileClearFlags = alloc_buffer<uint8_t>(GetNumTiles(), MemoryUsage::Framebuffer);
+        std::memset(TileClearFlags.get(), 0, GetNumTiles());
     }
 
+    // Clears take effect right away, so draws submitted to a Rasterizer but not yet flushed are drawn over the
+    // cleared buffers. Call Rasterizer::Flush() first if they should be cleared too.
     void Clear(uint32_t color, float depth) {
-        FillBuffer(ColorBuffer.get(), color);
+        ColorClearValue = color;
+        SetClearFlags(TileClearColor);
         ClearDepth(depth);
     }
-    void ClearDepth(float depth) { FillBuffer(DepthBuffer.get(), std::bit_cast<uint32_t>(depth)); }
+    void ClearDepth(float depth) {
+        DepthClearValue = depth;
+        SetClearFlags(TileClearDepth);
+        // Coarse depth is only 1/16 of the size, and tested before tiles are touched.
+        FillBuffer(CoarseDepthBuffer.get(), std::bit_cast<uint32_t>(depth), GetCoarseDepthSize());
+    }
+
+    // Fills the tile at `tileOffset` with the clear values, if it was cleared since it was last written.
+    [[gnu::always_inline]] void ResolveTileClear(uint32_t tileOffset) {
+        assert(tileOffset % TileNumPixels == 0 && "Offset must be aligned to a tile");
+        uint8_t& flags = TileClearFlags[tileOffset / TileNumPixels];
+        if (flags == 0) [[likely]] return;
+
+        if (flags & TileClearColor) VInt((int32_t)ColorClearValue).store(&ColorBuffer[tileOffset]);
+        if (flags & TileClearDepth) VFloat(DepthClearValue).store(&DepthBuffer[tileOffset]);
+        flags = 0;
+    }
+    // Fills all cleared tiles within a region aligned to tiles. Regions can be resolved in parallel.
+    void ResolveClears(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        for (uint32_t ty = y; ty < y + height; ty += TileSize) {
+            for (uint32_t tx = x; tx < x + width; tx += TileSize) {
+                ResolveTileClear(GetPixelOffset(tx, ty));
+            }
+        }
+    }
+    void ResolveClears() {
+        if (!HasPendingClears) return;
+        ResolveClears(0, 0, Width, Height);
+        HasPendingClears = false;
+    }
 
     // Iterate through framebuffer tiles, potentially in parallel. `visitor` takes base tile X and Y coords.
-    void IterateTiles(std::function<void(uint32_t, uint32_t)> visitor, uint32_t downscaleFactor = 1);
+    template<typename Visitor>
+    void IterateTiles(const Visitor& visitor, uint32_t downscaleFactor = 1) {
+        downscaleFactor *= 4;
+        uint32_t endY = Height / downscaleFactor * downscaleFactor;
+
+        // One bin at a time, so that each thread works on a contiguous range of memory.
+        ThreadPool::Shared().ParallelFor(BufferSize / BinNumPixels, 0, [&](uint32_t binId) {
+            uint32_t binX = (binId % BinStride) * BinSize, binY = (binId / BinStride) * BinSize;
+
+            for (uint32_t y = binY; y < std::min(binY + BinSize, endY); y += downscaleFactor) {
+                for (uint32_t x = binX; x < std::min(binX + BinSize, Width); x += downscaleFactor) {
+                    visitor(x, y);
+                }
+            }
+        });
+    }
 
     uint32_t GetPixelOffset(uint32_t x, uint32_t y) const {
         assert(x + 3 < Width && y + 3 < Height);
-        uint32_t tileId = (x >> TileShift) + (y >> TileShift) * TileStride;
+        uint32_t binId = (x >> BinShift) + (y >> BinShift) * BinStride;
+        uint32_t tileId = (x >> TileShift & BinTileMask) + ((y >> TileShift & BinTileMask) << BinTileShift);
         uint32_t pixelOffset = (x & TileMask) + (y & TileMask) * TileSize;
-        return tileId * TileNumPixels + pixelOffset;
+        return binId * BinNumPixels + tileId * TileNumPixels + pixelOffset;
     }
     VInt GetPixelOffset(VInt x, VInt y) const {
-        VInt tileId = (x >> TileShift) + (y >> TileShift) * (int32_t)TileStride;
+        VInt binId = (x >> BinShift) + (y >> BinShift) * (int32_t)BinStride;
+        VInt tileId = (x >> TileShift & BinTileMask) + ((y >> TileShift & BinTileMask) << BinTileShift);
         VInt pixelOffset = (x & TileMask) + (y & TileMask) * TileSize;
-        return tileId * TileNumPixels + pixelOffset;
+        return (binId << (BinShift * 2)) + (tileId << (TileShift * 2)) + pixelOffset;
+    }
+    // Returns the offset of the tile containing (x, y) in `CoarseDepthBuffer`. Tiles in a 16x16 block are contiguous.
+    uint32_t GetCoarseDepthOffset(uint32_t x, uint32_t y) const {
+        uint32_t blockId = (x >> CoarseBlockShift) + (y >> CoarseBlockShift) * CoarseStride;
+        uint32_t tileOffset = (x >> TileShift & 3) + (y >> TileShift & 3) * 4;
+        return blockId * TileNumPixels + tileOffset;
     }
 
     void WriteTile(uint32_t offset, uint16_t mask, VInt color, VFloat depth) {
-        _mm512_mask_store_epi32(&ColorBuffer[offset], mask, color);
-        _mm512_mask_store_ps(&DepthBuffer[offset], mask, depth);
+        color.store(&ColorBuffer[offset], mask);
+        depth.store(&DepthBuffer[offset], mask);
     }
 
+    // Returns a pointer to the attachment data, `T` must have the same size as its pixels.
     template<typename T>
     T* GetAttachmentBuffer(uint32_t attachmentId, size_t offset = 0) {
-        assert(attachmentId + sizeof(T) <= NumAttachments && "Missing attachment storage");
-        return (T*)&AttachmentBuffer[attachmentId * AttachmentStride] + offset;
+        assert(attachmentId < Attachments.size() && "Missing attachment");
+        assert(sizeof(T) == Attachments[attachmentId].BytesPerPixel && "Attachment format mismatch");
+        return (T*)&AttachmentBuffer[Attachments[attachmentId].Offset] + offset;
     }
 
     [[gnu::always_inline]] VFloat SampleDepth(VFloat x, VFloat y) const {
@@ -78,27 +189,35 @@ struct Framebuffer {
     [[gnu::always_inline]] VFloat SampleDepth(VInt ix, VInt iy) const {
         // Twos-complement unsigned compare trick to check for both (x >= 0 && x < N) at once.
         VInt indices = GetPixelOffset(ix, iy);
-        VMask boundMask = _mm512_cmplt_epu32_mask(ix, VInt((int32_t)Width)) & _mm512_cmplt_epu32_mask(iy, VInt((int32_t)Height));
-        return _mm512_mask_i32gather_ps(_mm512_set1_ps(1.0f), boundMask, indices, DepthBuffer.get(), 4);
+        VMask boundMask = simd::ult(ix, (int32_t)Width) & simd::ult(iy, (int32_t)Height);
+        return VFloat::gather<4>(DepthBuffer.get(), indices, boundMask, 1.0f);
     }
     [[gnu::always_inline]] VInt SampleColor(VInt ix, VInt iy, VInt defaultColor = 0) const {
         // Twos-complement unsigned compare trick to check for both (x >= 0 && x < N) at once.
         VInt indices = GetPixelOffset(ix, iy);
-        VMask boundMask = _mm512_cmplt_epu32_mask(ix, VInt((int32_t)Width)) & _mm512_cmplt_epu32_mask(iy, VInt((int32_t)Height));
-        return _mm512_mask_i32gather_epi32(defaultColor, boundMask, indices, ColorBuffer.get(), 4);
+        VMask boundMask = simd::ult(ix, (int32_t)Width) & simd::ult(iy, (int32_t)Height);
+        return VInt::gather<4>(ColorBuffer.get(), indices, boundMask, defaultColor);
     }
 
     void GetPixels(uint32_t* dest, uint32_t stride) const;
     void SaveImage(std::string_view filename) const;
 
 private:
-    void FillBuffer(void* ptr, uint32_t value) {
+    uint32_t GetCoarseDepthSize() const { return CoarseStride * ((Height + 15) >> CoarseBlockShift) * TileNumPixels; }
+    uint32_t GetNumTiles() const { return BufferSize / TileNumPixels; }
+
+    void SetClearFlags(uint8_t flags) {
+        for (uint32_t i = 0; i < GetNumTiles(); i++) {
+            TileClearFlags[i] |= flags;
+        }
+        HasPendingClears = true;
+    }
+
+    void FillBuffer(void* ptr, uint32_t value, uint32_t count) {
         // Non-temporal fill is ~2-3x faster than memset(), but makes rasterization a bit slower. Still a small win overall.
         // https://en.algorithmica.org/hpc/cpu-cache/bandwidth/
-        uint32_t count = Width * Height;
-
         for (uint32_t i = 0; i < count; i += 16) {
-            _mm512_stream_si512((uint32_t*)ptr + i, _mm512_set1_epi32((int32_t)value));
+            VInt((int32_t)value).stream((uint32_t*)ptr + i);
         }
     }
 };
@@ -109,17 +228,21 @@ struct VertexReader {
     const uint8_t* VertexBuffer;
     const uint8_t* IndexBuffer;
     uint32_t Count;
+    uint32_t VertexCount;  // Number of vertices referenced by the index buffer, or 0 if unknown
 
     IndexFormat IndexFormat;
     VInt _Indices = 0;    // Vertex indices to be read next
 
     // Note that the index buffer should be over-allocated by at least 256 extra bytes, as the rasterizer 
     // may read beyond `count` due to vector alignment.
-    VertexReader(const uint8_t* vertexBuffer, const uint8_t* indexBuffer, uint32_t count, enum IndexFormat ixf) {
+    // If `vertexCount` is given, each vertex is shaded only once per draw rather than once per triangle corner.
+    VertexReader(const uint8_t* vertexBuffer, const uint8_t* indexBuffer, uint32_t count, enum IndexFormat ixf,
+                 uint32_t vertexCount = 0) {
         VertexBuffer = vertexBuffer;
         IndexBuffer = indexBuffer;
         Count = count;
         IndexFormat = ixf;
+        VertexCount = vertexCount;
     }
 
     uint32_t ReadIndex(size_t offset) {
@@ -206,17 +329,34 @@ struct ShadedVertexPacket {
     }
 };
 
+// See PipelineState
+enum class DepthFunc : uint8_t { Always, Less, LessEqual, Equal, Greater, GreaterEqual };
+enum class CullMode : uint8_t { None, Back, Front };  // Front faces are counter-clockwise in device coordinates, as in OpenGL
+
 struct TrianglePacket {
     VInt MinX, MinY, MaxX, MaxY;
     VInt Weight0, Weight1, Weight2;
     VInt A01, A12, A20;
     VInt B01, B12, B20;
     VFloat RcpArea;
+    VInt PrimitiveId;  // Index of each triangle in its draw call, see VaryingBuffer::PrimitiveId
 
     ShadedVertexPacket Vertices[3];
 
-    // Computes edge variables based on shaded vertices.
-    void Setup(int32_t vpWidth, int32_t vpHeight, uint32_t numAttribs);
+    // Largest supported viewport size on each axis.
+    static constexpr uint32_t MaxViewportSize = 16384;
+
+    // Edge function values grow with the square of the guard band size, so sub-pixel precision is
+    // reduced for very large viewports to keep them within 32 bits.
+    static uint32_t GetSubpixelBits(uint32_t vpSize) { return vpSize > 8192 ? 2 : 4; }
+
+    // Size of the region in which triangles can be rasterized without clipping, centered on the viewport.
+    static uint32_t GetGuardBandSize(uint32_t vpSize) { return std::max(std::bit_ceil(vpSize), 2048u); }
+
+    // Computes edge variables based on shaded vertices. Triangles kept by `cull` with clockwise winding are flipped,
+    // so that the rasterizer only sees one winding.
+    // Returns a mask of triangles that may cover pixel samples, others can be discarded.
+    VMask Setup(int32_t vpWidth, int32_t vpHeight, uint32_t numAttribs, CullMode cull);
 };
 
 struct VaryingBuffer {
@@ -224,11 +364,18 @@ struct VaryingBuffer {
 
     const float* Attribs;
     uint32_t TileOffset;
+    uint32_t PrimitiveId;  // Index of the triangle being shaded in its draw call, the same for all fragments of clipped triangles
     VMask TileMask;
 
     VFloat W1, W2;
     VFloat Depth;
 
+    // Set for quads packed from several tiles and triangles by a `FragmentQueue`, in which case `TileOffset` and
+    // `PrimitiveId` are unused. Attributes are then fetched from a different triangle slot in each lane, and
+    // fragments must be written with `StoreFragments()`.
+    bool IsPacked;
+    VInt TriangleSlots, PixelOffsets;
+
     // Interpolates vertex attributes using the current barycentric weights.
     VFloat GetSmooth(int32_t attrId) const {
         VFloat v0 = GetFlat(attrId, 0);
@@ -245,9 +392,25 @@ struct VaryingBuffer {
         assert(vertexId >= 0 && vertexId < 3);
 
         int32_t idx = attrId * (int32_t)VFloat::Length + (int32_t)(vertexId * (sizeof(ShadedVertexPacket) / 4));
+
+        if (IsPacked) {
+            return simd::permute(VFloat::load(&Attribs[idx]), TriangleSlots);
+        }
         return Attribs[idx];
     }
 
+    // Writes the value of each covered fragment to a framebuffer-sized buffer, such as the color buffer or an attachment.
+    template<typename T, typename V>
+    void StoreFragments(T* buffer, V value) const {
+        if (!IsPacked) {
+            value.store(&buffer[TileOffset], TileMask);
+            return;
+        }
+        for (uint32_t i : BitIter(TileMask)) {
+            buffer[PixelOffsets[i]] = value[i];
+        }
+    }
+
     // Interpolates a vector of vertex attributes. `T` should be a struct containing only `VFloat` fields.
     template<typename T>
     T GetSmooth(int32_t attrId) const {
@@ -274,6 +437,8 @@ struct VaryingBuffer {
     }
 };
 
+// Clips triangle packets against the frustum planes, all lanes at once. Polygons are kept in the same SoA layout as
+// triangle packets, with a vertex count per lane, and are triangulated as fans with each triangle staying in its lane.
 struct Clipper {
     enum class Plane {
         Left = 0,    // X-
@@ -283,27 +448,35 @@ struct Clipper {
         Near = 4,    // Z-
         Far = 5,     // Z+
     };
-    struct Vertex {
-        float Attribs[(ShadedVertexPacket::MaxAttribs + 4 + VFloat::Length - 1) & ~(VFloat::Length - 1)];
-    };
     struct ClipCodes {
         VMask AcceptMask;       // Triangles that are in-bounds and can be immediately rasterized.
         VMask NonTrivialMask;   // Triangles that need to be clipped.
-        uint8_t OutCodes[16];   // Planes that need to be clipped against (per-triangle).
+        VInt OutCodes;          // Planes that need to be clipped against (per-triangle).
     };
+    // Each plane adds at most one vertex to a convex polygon.
+    static const uint32_t MaxVertices = 9;
 
-    uint32_t Count, FreeVtx;
     float GuardBandPlaneDistXY[2]{ 1.0f, 1.0f };
-    uint8_t Indices[24];
-    Vertex Vertices[24];
+
+    VInt Count;         // Number of vertices in the clipped polygon of each lane
+    uint32_t MaxCount;  // Max of `Count` over all lanes
 
     // Compute Cohen-Sutherland clip codes
     ClipCodes ComputeClipCodes(const TrianglePacket& tri);
 
-    void ClipAgainstPlane(Plane plane, uint32_t numAttribs);
+    // Clips the non-trivial triangles in `tri` against the planes in their outcodes.
+    void ClipTriangles(const TrianglePacket& tri, const ClipCodes& cc, uint32_t numAttribs);
+
+    // Writes triangle `fanIdx` of the clipped polygons to the lanes in `mask` of `destTri`.
+    // Each lane takes the triangle from lane `srcLanes[i]`.
+    void StoreTriangles(TrianglePacket& destTri, uint32_t fanIdx, VInt srcLanes, VMask mask, uint32_t numAttribs);
 
-    void LoadTriangle(TrianglePacket& srcTri, uint32_t srcTriIdx, uint32_t numAttribs);
-    void StoreTriangle(TrianglePacket& destTri, uint32_t destTriIdx, uint32_t srcTriFanIdx, uint32_t numAttribs);
+private:
+    ShadedVertexPacket _buffers[2][MaxVertices];
+    const ShadedVertexPacket* _polygon;
+
+    template<bool FromTriangle>
+    void ClipAgainstPlane(const ShadedVertexPacket* src, ShadedVertexPacket* dest, Plane plane, VMask mask, uint32_t numAttribs);
 };
 
 template<typename T>
@@ -314,72 +487,490 @@ concept ShaderProgram =
         { s.ShadePixels(fb, vars) } -> std::same_as<void>;
     };
 
-struct TriangleBatch {
-    static const uint32_t MaxSize = 4096 / VFloat::Length;
-    static const uint32_t BinSizeLog2 = 7, BinSize = 1 << BinSizeLog2;
+// Shaders can set `static const bool PackFragments = true` to have sparsely covered tiles packed into full batches
+// by a `FragmentQueue`. Their pixel shader must then write through `VaryingBuffer::StoreFragments()`.
+template<typename T>
+constexpr bool PacksFragments = requires { requires T::PackFragments; };
+
+// Fixed function state of a draw. Shaders can declare it as `static constexpr PipelineState Pipeline = { ... }`,
+// and the raster loop is specialized for it, so unused tests and writes compile away.
+struct PipelineState {
+    DepthFunc DepthTest = DepthFunc::Less;
+    bool DepthWrite = true;  // Written by the rasterizer after ShadePixels(), for fragments left in `TileMask`
+    CullMode Cull = CullMode::Back;
+    bool ColorWrite = true;  // Color and attachments are written by ShadePixels(), which is not called if this is off
+};
+
+template<typename T>
+constexpr PipelineState ShaderPipeline = []() {
+    if constexpr (requires { T::Pipeline; }) {
+        return PipelineState(T::Pipeline);
+    } else {
+        return PipelineState{};
+    }
+}();
+
+template<DepthFunc Func>
+inline VMask DepthTest(VFloat newDepth, VFloat oldDepth) {
+    if constexpr (Func == DepthFunc::Less) {
+        return newDepth < oldDepth;
+    } else if constexpr (Func == DepthFunc::LessEqual) {
+        return newDepth <= oldDepth;
+    } else if constexpr (Func == DepthFunc::Equal) {
+        return newDepth == oldDepth;
+    } else if constexpr (Func == DepthFunc::Greater) {
+        return newDepth > oldDepth;
+    } else if constexpr (Func == DepthFunc::GreaterEqual) {
+        return newDepth >= oldDepth;
+    } else {
+        return 0xFFFF;
+    }
+}
+
+// Conservative test of the nearest depth of a triangle against the farthest depth of a tile (see
+// Framebuffer::CoarseDepthBuffer). Only compare functions that pass for nearer fragments can reject tiles with it.
+template<DepthFunc Func, typename T>
+inline auto CoarseDepthTest(float minDepth, T maxTileDepth) {
+    if constexpr (Func == DepthFunc::Less) {
+        return minDepth < maxTileDepth;
+    } else if constexpr (Func == DepthFunc::LessEqual || Func == DepthFunc::Equal) {
+        return minDepth <= maxTileDepth;
+    } else if constexpr (std::is_same_v<T, float>) {
+        return true;
+    } else {
+        return (VMask)0xFFFF;
+    }
+}
+
+// Quads of sparsely covered tiles, queued by the rasterizer so that they can be shaded in 16-lane batches.
+// Whole 2x2 quads are kept at the same lanes of a quad in the batch, so that derivatives and mip selection work
+// as they do for tiles. The queue is flushed before depth testing tiles that overlap queued quads, so that
+// fragments are still depth tested and shaded in submission order.
+struct FragmentQueue {
+    static const uint32_t MaxQuads = VInt::Length / 4;
+
+    // First lane of each quad in a 4x4 tile or batch, others are at +1, +4, +5.
+    static uint32_t GetQuadLane(uint32_t quad) { return (quad & 1) * 2 + (quad & 2) * 4; }
+    static VMask GetQuadMask(uint32_t quad) { return (VMask)(0x33 << GetQuadLane(quad)); }
+
+    ShadedVertexPacket Vertices[3];  // Attributes of the queued triangles, one per lane
+    VFloat W1, W2, Depth;
+    VInt TriangleSlots, PixelOffsets;
+    VMask Mask = 0;
+
+    uint32_t NumQuads = 0, NumTriangles = 0;
+    uint32_t TileOffsets[MaxQuads], CoarseOffsets[MaxQuads];
+    VMask TileMasks[MaxQuads];  // Pixels covered by each quad in its source tile
+
+    const TrianglePacket* LastTriangle = nullptr;
+    uint32_t LastTriangleIndex = 0;
+
+    bool Overlaps(uint32_t tileOffset, VMask tileMask) const {
+        for (uint32_t i = 0; i < NumQuads; i++) {
+            if (TileOffsets[i] == tileOffset && (TileMasks[i] & tileMask)) return true;
+        }
+        return false;
+    }
 
-    std::unique_ptr<std::vector<uint16_t>[]> Bins;
-    uint32_t BinsPerRow, NumBins;
+    // Returns the slot of the triangle, copying its attributes if it is not the last one queued.
+    uint32_t AddTriangle(const TrianglePacket& tri, uint32_t index, uint32_t numAttribs) {
+        if (LastTriangle == &tri && LastTriangleIndex == index) return NumTriangles - 1;
 
-    uint32_t Count = 0;
-    TrianglePacket Triangles[MaxSize];
+        uint32_t slot = NumTriangles++;
+        assert(slot < MaxQuads);
+
+        for (uint32_t vi = 0; vi < 3; vi++) {
+            const VFloat* src = tri.Vertices[vi].Attribs;
+            VFloat* dest = Vertices[vi].Attribs;
+
+            for (int32_t j = VaryingBuffer::AttribZ; j < (int32_t)numAttribs; j++) {
+                dest[j][slot] = src[j][index];
+            }
+        }
+        LastTriangle = &tri;
+        LastTriangleIndex = index;
+        return slot;
+    }
+
+    // Moves a quad of the tile described by `vars` into the next free quad of the batch.
+    void AddQuad(const VaryingBuffer& vars, uint32_t quad, uint32_t coarseOffset, uint32_t triangleSlot) {
+        assert(NumQuads < MaxQuads);
+
+        uint32_t srcLane = GetQuadLane(quad), destLane = GetQuadLane(NumQuads);
+        VMask destMask = GetQuadMask(NumQuads);
+        VInt srcLanes = VInt::ramp() + (int32_t)(srcLane - destLane);
+
+        W1 = simd::csel(destMask, simd::permute(vars.W1, srcLanes), W1);
+        W2 = simd::csel(destMask, simd::permute(vars.W2, srcLanes), W2);
+        Depth = simd::csel(destMask, simd::permute(vars.Depth, srcLanes), Depth);
+        PixelOffsets = simd::csel(destMask, (srcLanes & 15) + (int32_t)vars.TileOffset, PixelOffsets);
+        TriangleSlots = simd::csel(destMask, VInt((int32_t)triangleSlot), TriangleSlots);
+        Mask |= (VMask)((vars.TileMask >> srcLane & 0x33) << destLane);
+
+        TileOffsets[NumQuads] = vars.TileOffset;
+        CoarseOffsets[NumQuads] = coarseOffset;
+        TileMasks[NumQuads] = vars.TileMask & GetQuadMask(quad);
+        NumQuads++;
+    }
+
+    void Clear() {
+        Mask = 0;
+        NumQuads = NumTriangles = 0;
+        LastTriangle = nullptr;
+    }
+};
 
-    TriangleBatch(uint32_t fbWidth, uint32_t fbHeight) {
-        BinsPerRow = (fbWidth + BinSize - 1) >> BinSizeLog2;
-        NumBins = ((fbHeight + BinSize - 1) >> BinSizeLog2) * BinsPerRow;
-        Bins = std::make_unique<std::vector<uint16_t>[]>(NumBins);
+// Bump allocator for trivially destructible objects that live until the next Reset().
+class LinearArena {
+    static const size_t BlockSize = 64 * 1024;
+
+    std::vector<AlignedBuffer<uint8_t>> _blocks;
+    uint32_t _blockIdx = 0;
+    size_t _blockPos = 0;
+
+public:
+    void* Alloc(size_t size, size_t align) {
+        assert(size <= BlockSize && align <= 64);
+
+        _blockPos = (_blockPos + align - 1) & ~(align - 1);
+
+        if (_blockIdx >= _blocks.size() || _blockPos + size > BlockSize) {
+            if (_blockIdx < _blocks.size()) _blockIdx++;
+            if (_blockIdx >= _blocks.size()) _blocks.push_back(alloc_buffer<uint8_t>(BlockSize, MemoryUsage::Batch));
+            _blockPos = 0;
+        }
+        void* ptr = &_blocks[_blockIdx][_blockPos];
+        _blockPos += size;
+        return ptr;
+    }
+
+    template<typename T, typename... Args>
+    T* New(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena doesn't run destructors");
+        return new (Alloc(sizeof(T), alignof(T))) T{ std::forward<Args>(args)... };
+    }
+
+    // Allocates blocks up front, so that at least `size` bytes can be allocated before the next one is needed.
+    void Reserve(size_t size) {
+        while (_blocks.size() * BlockSize < size) {
+            _blocks.push_back(alloc_buffer<uint8_t>(BlockSize, MemoryUsage::Batch));
+        }
+    }
+    void Reset() { _blockIdx = 0, _blockPos = 0; }
+};
+
+// Fixed-size block of bin entries, linked into a list for each bin.
+struct BinChunk {
+    static const uint32_t Capacity = 60;  // 256 bytes per chunk
+
+    uint32_t Entries[Capacity];
+    uint32_t Count;
+    BinChunk* Next;
+};
+
+// Output of triangle setup. Each setup thread fills its own batch, and bins from all batches are
+// merged back in submission order during rasterization.
+struct TriangleBatch {
+    static const uint32_t DefaultCapacity = 4096;  // In triangles
+    // Bin size is picked by the rasterizer based on the framebuffer size and number of threads.
+    static const uint32_t MinBinSizeLog2 = 5, MaxBinSizeLog2 = Framebuffer::BinShift;
+    // Worst case number of packets written by setup for each input packet (every triangle clipped into 7).
+    static const uint32_t MaxPacketsPerInput = 8;
+
+    struct BinList {
+        BinChunk* Head;
+        BinChunk* Tail;
+        uint32_t NumChunks;
+        uint32_t NumTriangles;  // Used to schedule the heaviest bins first
+    };
+    // Bin entries are triangle ids, `packetIndex * VFloat::Length + lane`. Chunks are carved from `BinArena`,
+    // which keeps its blocks across frames, so binning doesn't allocate once it has grown to the workload.
+    std::unique_ptr<BinList[]> Bins;
+    LinearArena BinArena;
+    AlignedBuffer<uint32_t> ActiveBins;  // Indices of bins with at least one triangle, so that empty ones can be skipped
+    uint32_t NumActiveBins = 0;
+    uint32_t BinSizeLog2, BinsPerRow, NumBins;
+
+    uint32_t Capacity;  // In packets
+    uint32_t Count = 0;
+    uint32_t ChunkId = 0, DrawId = 0;  // Assigned to new packets
+    AlignedBuffer<TrianglePacket> Triangles;
+    AlignedBuffer<uint16_t> DrawIds;   // Index of the draw call that produced each packet
+    // Index of the input chunk that produced each packet, relative to the start of the current pass.
+    // Entries of a bin are sorted by it, see Rasterizer::RasterizeBin().
+    AlignedBuffer<uint16_t> ChunkIds;
+
+    // `capacity` is in triangles. Triangle storage goes on the NUMA node of `setupThread` with NumaPolicy::Partitioned.
+    TriangleBatch(uint32_t fbWidth, uint32_t fbHeight, uint32_t binSizeLog2, uint32_t capacity, uint32_t setupThread) {
+        assert(binSizeLog2 >= MinBinSizeLog2 && binSizeLog2 <= MaxBinSizeLog2);
+        BinSizeLog2 = binSizeLog2;
+        BinsPerRow = (fbWidth + (1u << binSizeLog2) - 1) >> binSizeLog2;
+        NumBins = ((fbHeight + (1u << binSizeLog2) - 1) >> binSizeLog2) * BinsPerRow;
+        Bins = std::make_unique<BinList[]>(NumBins);
+        ActiveBins = alloc_buffer<uint32_t>(NumBins, MemoryUsage::Batch);
+
+        Capacity = (capacity + VFloat::Length - 1) / VFloat::Length;
+        void* triangles = AllocMemory(Capacity * sizeof(TrianglePacket), alignof(TrianglePacket), MemoryUsage::Batch, (int32_t)setupThread);
+        Triangles = AlignedBuffer<TrianglePacket>((TrianglePacket*)triangles);
+        DrawIds = alloc_buffer<uint16_t>(Capacity, MemoryUsage::Batch);
+        ChunkIds = alloc_buffer<uint16_t>(Capacity, MemoryUsage::Batch);
+
+        // Enough for one chunk per bin plus one entry per triangle, more blocks are added if triangles span many bins.
+        BinArena.Reserve((NumBins + Capacity * VFloat::Length / BinChunk::Capacity) * sizeof(BinChunk));
     }
 
     TrianglePacket& Alloc() {
-        assert(Count < MaxSize);
+        assert(Count < Capacity);
+        DrawIds[Count] = (uint16_t)DrawId;
+        ChunkIds[Count] = (uint16_t)ChunkId;
         return Triangles[Count++];
     }
     TrianglePacket& PeekLast(uint32_t offset = 0) {
-        assert(Count - 1 + offset < MaxSize);
+        assert(Count - 1 + offset < Capacity);
         return Triangles[Count - 1 + offset];
     }
     void AddBin(uint32_t x, uint32_t y, TrianglePacket& tri, uint32_t index) {
-        assert((&tri - Triangles) < MaxSize);
+        assert((&tri - Triangles.get()) < Capacity);
+
+        uint32_t binId = x + y * BinsPerRow;
+        BinList& bin = Bins[binId];
+
+        if (bin.Tail == nullptr || bin.Tail->Count == BinChunk::Capacity) {
+            BinChunk* chunk = (BinChunk*)BinArena.Alloc(sizeof(BinChunk), alignof(BinChunk));
+            chunk->Count = 0;
+            chunk->Next = nullptr;
+
+            if (bin.Tail == nullptr) {
+                bin.Head = chunk;
+                ActiveBins[NumActiveBins++] = binId;
+            } else {
+                bin.Tail->Next = chunk;
+            }
+            bin.Tail = chunk;
+            bin.NumChunks++;
+        }
+        bin.Tail->Entries[bin.Tail->Count++] = (uint32_t)(&tri - Triangles.get()) * VFloat::Length + index;
+        bin.NumTriangles++;
+    }
+    // Checks if there's enough space left to setup `numPackets` input packets, accounting for clipping.
+    bool CanFit(uint32_t numPackets) const { return Count + numPackets * MaxPacketsPerInput <= Capacity; }
 
-        uint32_t id = (&tri - Triangles) * VFloat::Length + index;
-        Bins[x + y * BinsPerRow].push_back(id);
+    // Called once all bins have been rasterized.
+    void Reset() {
+        for (uint32_t i = 0; i < NumActiveBins; i++) {
+            Bins[ActiveBins[i]] = {};
+        }
+        Count = NumActiveBins = 0;
+        BinArena.Reset();
     }
-    bool IsFull() { return Count >= MaxSize - 24; } //Reserve 24*vec triangles for clipping
 };
 
 class Rasterizer {
+    // Number of input packets setup threads take at a time. The chunk index is
+    // stored in 16 bits, see TriangleBatch::ChunkIds.
+    static const uint32_t SetupChunkSize = 4;
+    static constexpr uint32_t MaxSetupThreads = 256;
+    static const uint32_t MaxDraws = 65536;  // See TriangleBatch::DrawIds
+
+    // Triangle range being set up. Threads take chunks in increasing order until their batch is full,
+    // so the chunks processed in a pass are always contiguous and bins of each batch are sorted by chunk.
+    struct SetupQueue {
+        std::atomic<uint32_t> NextChunk;
+        uint32_t PassStart, PassEnd;  // Chunk range available to the current pass
+        uint32_t NumChunks;
+    };
+    using BatchSet = std::vector<std::unique_ptr<TriangleBatch>>;
+
     std::shared_ptr<Framebuffer> _fb;
-    std::unique_ptr<TriangleBatch> _batch;
-    Clipper _clipper;
+    BatchSet _batches[2];  // One batch per setup thread, double-buffered so that setup overlaps rasterization
+    uint32_t _batchCapacity;
+    std::unique_ptr<Clipper[]> _clippers;
+
+    // Part of the framebuffer rasterized by a task. Bins with many more triangles than others are split
+    // into quadrants, so that several threads can work on them.
+    struct BinTask {
+        uint32_t BinId;
+        uint32_t X, Y, Size;
+        uint32_t Weight;  // Number of triangles in the bin
+    };
+    std::vector<BinTask> _binTasks;
+    std::vector<uint32_t> _activeBins;  // Scratch for ScheduleBins()
+    std::vector<uint32_t> _taskOrder;  // Setup and bin task indices, in the order given to ParallelFor()
 
     struct BinnedTriangle {
-        uint32_t X, Y;
+        uint32_t X, Y, Size;  // Bounds of the task
         uint16_t TriangleIndex;
         const TrianglePacket* Triangle;
+        FragmentQueue* Queue;  // Shared by all draws in the bin, flushed whenever the draw changes
     };
+    struct BinCursor {
+        const BinChunk* Chunk;
+        uint32_t Pos;
+    };
+    // Entry points instantiated by Submit() for the shader type. They are plain function pointers taking the draw
+    // state, and DrawFn takes a whole run of triangles, so that the shader inlines into the raster loop.
     struct ShaderInterface {
-        std::function<void(size_t, ShadedVertexPacket[3])> ReadVtxFn;
-        std::function<void(const BinnedTriangle&)> DrawFn;
+        const void* State;  // DrawState, in `_drawArena`
+        void (*ReadVtxFn)(const void* state, size_t offset, ShadedVertexPacket vertices[3]);
+        void (*ShadeVtxFn)(const void* state, uint32_t firstVertex, ShadedVertexPacket& vertices);  // Vertices [i, i + VInt::Length)
+        void (*DrawFn)(Rasterizer& rast, const void* state, BinnedTriangle& bt, const TriangleBatch& batch, BinCursor& cursor);
+        void (*FlushFn)(Rasterizer& rast, const void* state, FragmentQueue& queue);  // Only set for shaders that pack fragments
         uint32_t NumCustomAttribs;
+        CullMode Cull;  // Applied during setup, the rest of the pipeline state is specialized into DrawFn
+    };
+    // Recorded draw call. Shader and vertex reader copies are kept in `_drawArena`.
+    struct DrawCall {
+        ShaderInterface Shader;
+        const VertexReader* Vertices;
+        uint32_t NumTriangles;
+        uint32_t NumVertexPackets;  // Non-zero if vertices are shaded into the vertex cache
+        uint32_t FirstChunk;        // Assigned by Flush()
+        uint32_t FirstVertexPacket;
+        size_t VertexCacheOffset;
     };
+    std::vector<DrawCall> _draws;
+    LinearArena _drawArena;
+
+    // Post-transform vertices of all cached draws, as packets of `VInt::Length` vertices in SoA layout.
+    // Each packet takes 4 + NumCustomAttribs vectors, those of a draw start at `VertexCacheOffset`.
+    AlignedBuffer<VFloat> _vertexCache;
+    size_t _vertexCacheCapacity = 0;
+
+    void ShadeVertexPackets();
+    void ReadCachedTriangles(const DrawCall& draw, size_t offset, ShadedVertexPacket vertices[3]);
+    void SetupChunks(TriangleBatch& batch, Clipper& clipper, SetupQueue& queue);
+    void SetupTriangles(TriangleBatch& batch, Clipper& clipper, uint32_t numAttribs, CullMode cull);
+    void BinTriangles(TriangleBatch& batch, TrianglePacket& tris, VMask mask, uint32_t numAttribs, CullMode cull);
+    uint32_t ChooseBinSizeLog2(uint32_t numThreads) const;
+    void ScheduleBins(const BatchSet& batches, bool allBins);
+    void ScheduleTasks(uint32_t numSetupTasks);
+    void RasterizeBin(BatchSet& batches, const BinTask& task);
+
+    // Shades packed quads, then writes their depth and updates the coarse depth of their tiles.
+    template<ShaderProgram TShader>
+    void FlushFragments(const TShader& shader, FragmentQueue& queue) {
+        constexpr PipelineState State = ShaderPipeline<TShader>;
+        Framebuffer& fb = *_fb.get();
+
+        VaryingBuffer vars = {
+            .Attribs = (float*)&queue.Vertices->Attribs,
+            .TileMask = queue.Mask,
+            .W1 = queue.W1,
+            .W2 = queue.W2,
+            .Depth = queue.Depth,
+            .IsPacked = true,
+            .TriangleSlots = queue.TriangleSlots,
+            .PixelOffsets = queue.PixelOffsets,
+        };
+        shader.ShadePixels(fb, vars);
+
+        if constexpr (State.DepthWrite) {
+            vars.StoreFragments(fb.DepthBuffer.get(), vars.Depth);
+
+            for (uint32_t i = 0; i < queue.NumQuads; i++) {
+                fb.CoarseDepthBuffer[queue.CoarseOffsets[i]] = simd::reduce_max(VFloat::load(&fb.DepthBuffer[queue.TileOffsets[i]]));
+            }
+        }
+        queue.Clear();
+    }
+
+    // Depth tests and shades a tile covered by the triangle, then writes depth and updates its coarse depth.
+    // For shaders that pack fragments, tiles with at most 2 covered quads are queued instead.
+    template<ShaderProgram TShader>
+    [[gnu::always_inline]] void ShadeTile(const TShader& shader, const TrianglePacket& tri, uint32_t i,  //
+                                          uint32_t x, uint32_t y, VMask tileMask, VInt w1, VInt w2, FragmentQueue& queue) {
+        constexpr PipelineState State = ShaderPipeline<TShader>;
+        Framebuffer& fb = *_fb.get();
+        float area = tri.RcpArea[i];
+
+        VaryingBuffer vars = {
+            .Attribs = (float*)&tri.Vertices->Attribs + i,
+            .TileOffset = fb.GetPixelOffset(x, y),
+            .PrimitiveId = (uint32_t)tri.PrimitiveId[i],
+            .W1 = simd::conv2f(w1) * area,
+            .W2 = simd::conv2f(w2) * area,
+        };
+        // Queued fragments must be written before the depth test, if they cover the same pixels.
+        if constexpr (PacksFragments<TShader> && State.ColorWrite) {
+            if (queue.NumQuads != 0 && queue.Overlaps(vars.TileOffset, tileMask)) {
+                FlushFragments(shader, queue);
+            }
+        }
+        fb.ResolveTileClear(vars.TileOffset);
+
+        VFloat oldDepth = VFloat::load(&fb.DepthBuffer[vars.TileOffset]);
+        VFloat newDepth = vars.GetSmooth(VaryingBuffer::AttribZ);
+
+        tileMask &= DepthTest<State.DepthTest>(newDepth, oldDepth);
+
+        if (simd::any(tileMask)) {
+            vars.Depth = newDepth;
+            vars.TileMask = tileMask;
+
+            if constexpr (PacksFragments<TShader> && State.ColorWrite) {
+                uint32_t quadMask = 0;
+
+                for (uint32_t q = 0; q < 4; q++) {
+                    quadMask |= (tileMask & FragmentQueue::GetQuadMask(q)) ? 1u << q : 0;
+                }
+                if (std::popcount(quadMask) <= 2) {
+                    uint32_t coarseOffset = fb.GetCoarseDepthOffset(x, y);
+
+                    for (uint32_t q : BitIter(quadMask)) {
+                        if (queue.NumQuads == FragmentQueue::MaxQuads) {
+                            FlushFragments(shader, queue);
+                        }
+                        queue.AddQuad(vars, q, coarseOffset, queue.AddTriangle(tri, i, TShader::NumCustomAttribs));
+                    }
+                    return;
+                }
+            }
+
+            if constexpr (State.ColorWrite) {
+                [[clang::always_inline]] shader.ShadePixels(fb, vars);
+            }
+            if constexpr (State.DepthWrite) {
+                // The shader may have discarded fragments from `TileMask`
+                vars.Depth.store(&fb.DepthBuffer[vars.TileOffset], vars.TileMask);
+                fb.CoarseDepthBuffer[fb.GetCoarseDepthOffset(x, y)] = simd::reduce_max(VFloat::load(&fb.DepthBuffer[vars.TileOffset]));
+            }
+        }
+    }
+
+    // Draws the triangles at `cursor` that were set up from the same chunk, and advances it past them.
+    // Chunks never span draws, so they all use `shader`.
+    template<ShaderProgram TShader>
+    void DrawBinnedRun(const TShader& shader, BinnedTriangle& bt, const TriangleBatch& batch, BinCursor& cursor) {
+        uint32_t chunkId = batch.ChunkIds[cursor.Chunk->Entries[cursor.Pos] / VFloat::Length];
 
-    void Draw(VertexReader& vertexData, const ShaderInterface& shader);
+        while (cursor.Chunk != nullptr) {
+            uint32_t triangleId = cursor.Chunk->Entries[cursor.Pos];
+            uint32_t packetId = triangleId / VFloat::Length;
+            if (batch.ChunkIds[packetId] != chunkId) break;
 
-    void SetupTriangles(TriangleBatch& batch, uint32_t numAttribs);
-    void BinTriangles(TriangleBatch& batch, TrianglePacket& tris, VMask mask, uint32_t numAttribs);
+            bt.Triangle = &batch.Triangles[packetId];
+            bt.TriangleIndex = triangleId % VFloat::Length;
+            DrawBinnedTriangle(shader, bt);
+
+            if (++cursor.Pos == cursor.Chunk->Count) {
+                cursor = { cursor.Chunk->Next, 0 };
+            }
+        }
+    }
 
     template<ShaderProgram TShader>
-    void DrawBinnedTriangle(const TShader& shader, const BinnedTriangle& bin) {
+    [[gnu::always_inline]] void DrawBinnedTriangle(const TShader& shader, const BinnedTriangle& bin) {
+        constexpr PipelineState State = ShaderPipeline<TShader>;
         Framebuffer& fb = *_fb.get();
         const TrianglePacket& tri = *bin.Triangle;
         uint32_t i = bin.TriangleIndex;
 
         uint32_t minX = (uint32_t)tri.MinX[i];
         uint32_t minY = (uint32_t)tri.MinY[i];
-        uint32_t maxX = std::min((uint32_t)tri.MaxX[i], bin.X + TriangleBatch::BinSize - 4);
-        uint32_t maxY = std::min((uint32_t)tri.MaxY[i], bin.Y + TriangleBatch::BinSize - 4);
+        uint32_t maxX = std::min((uint32_t)tri.MaxX[i], bin.X + bin.Size - 4);
+        uint32_t maxY = std::min((uint32_t)tri.MaxY[i], bin.Y + bin.Size - 4);
 
-        VInt tileOffsX = FragPixelOffsetsX, tileOffsY = FragPixelOffsetsY;
+        VInt tileOffsX = FragPixelOffsetsX(), tileOffsY = FragPixelOffsetsY();
 
         if (minX < bin.X) {
             tileOffsX += (int32_t)(bin.X - minX);
@@ -389,79 +980,197 @@ class Rasterizer {
             tileOffsY += (int32_t)(bin.Y - minY);
             minY = bin.Y;
         }
+        // Triangles of split bins may not overlap all quadrants
+        if (maxX < minX || maxY < minY) return;
 
-        __builtin_assume(minX >= maxX);
-        __builtin_assume(minY >= maxY);
+        __builtin_assume(maxX >= minX);
+        __builtin_assume(maxY >= minY);
         __builtin_assume(minX % 4 == 0);
         __builtin_assume(minY % 4 == 0);
 
+        // Nearest depth of the triangle, for rejecting tiles against the coarse depth buffer. Depth is interpolated
+        // linearly so this is the min over the vertices, biased slightly as interpolation may round below it.
+        float minDepth = tri.Vertices[0].Position.z[i] +
+                         std::min({ 0.0f, tri.Vertices[1].Position.z[i], tri.Vertices[2].Position.z[i] });
+        minDepth -= std::abs(minDepth) * (1.0f / 65536);
+
         // TODO: Investigate how costly these lane accesses actually are, considering each will be on a different cache-line.
         //       it might be faster to recompute or maybe shuffle after setup to a friendlier layout.
-        VInt stepX0 = tri.A12[i], stepX1 = tri.A20[i], stepX2 = tri.A01[i];
-        VInt stepY0 = tri.B12[i], stepY1 = tri.B20[i], stepY2 = tri.B01[i];
+        VInt weights[3] = { tri.Weight0[i], tri.Weight1[i], tri.Weight2[i] };
+        int32_t stepX[3] = { tri.A12[i], tri.A20[i], tri.A01[i] };
+        int32_t stepY[3] = { tri.B12[i], tri.B20[i], tri.B01[i] };
 
-        // Barycentric coordinates at start of row
-        VInt rowW0 = tri.Weight0[i] + stepX0 * tileOffsX + stepY0 * tileOffsY;
-        VInt rowW1 = tri.Weight1[i] + stepX1 * tileOffsX + stepY1 * tileOffsY;
-        VInt rowW2 = tri.Weight2[i] + stepX2 * tileOffsX + stepY2 * tileOffsY;
+        // Small triangles covering up to 2x2 tiles, which are the majority in dense meshes, skip block setup.
+        if (maxX - minX < 8 && maxY - minY < 8) {
+            VInt rowW0 = weights[0] + stepX[0] * tileOffsX + stepY[0] * tileOffsY;
+            VInt rowW1 = weights[1] + stepX[1] * tileOffsX + stepY[1] * tileOffsY;
+            VInt rowW2 = weights[2] + stepX[2] * tileOffsX + stepY[2] * tileOffsY;
 
-        stepX0 *= 4, stepX1 *= 4, stepX2 *= 4;
-        stepY0 *= 4, stepY1 *= 4, stepY2 *= 4;
+            for (uint32_t y = minY; y <= maxY; y += 4) {
+                VInt w0 = rowW0, w1 = rowW1, w2 = rowW2;
 
-        float area = tri.RcpArea[i];
+                for (uint32_t x = minX; x <= maxX; x += 4) {
+                    VMask tileMask = (w0 | w1 | w2) >= 0;
+                    float coarseDepth = fb.CoarseDepthBuffer[fb.GetCoarseDepthOffset(x, y)];
+
+                    if (simd::any(tileMask) && CoarseDepthTest<State.DepthTest>(minDepth, coarseDepth)) {
+                        ShadeTile(shader, tri, i, x, y, tileMask, w1, w2, *bin.Queue);
+                    }
+                    w0 += stepX[0] * 4, w1 += stepX[1] * 4, w2 += stepX[2] * 4;
+                }
+                rowW0 += stepY[0] * 4, rowW1 += stepY[1] * 4, rowW2 += stepY[2] * 4;
+            }
+            return;
+        }
+
+        // Pixels are walked in blocks of 16x16, each covering 4x4 tiles. Edge functions are linear, so testing
+        // them at the corners of every tile in the block finds which tiles are fully outside or inside an edge,
+        // with one vector compare per edge for the whole block.
+        VInt blockTileX = FragPixelOffsetsX() * 4, blockTileY = FragPixelOffsetsY() * 4;
+        VInt pixelW[3], blockW[3];
+        int32_t rejectBias[3], acceptBias[3];
 
-        for (uint32_t y = minY; y <= maxY; y += 4) {
-            VInt w0 = rowW0, w1 = rowW1, w2 = rowW2;
+        for (uint32_t j = 0; j < 3; j++) {
+            VInt w = weights[j] + stepX[j] * tileOffsX + stepY[j] * tileOffsY;
+            VInt origin = w[0];
 
-            for (uint32_t x = minX; x <= maxX; x += 4) {
-                VMask tileMask = (w0 | w1 | w2) >= 0;
+            pixelW[j] = w - origin;  // Relative to the first pixel of a tile
+            blockW[j] = origin + stepX[j] * blockTileX + stepY[j] * blockTileY;
+
+            // Distance from the first pixel of a tile to the max and min edge values over it
+            rejectBias[j] = (std::max(stepX[j], 0) + std::max(stepY[j], 0)) * 3;
+            acceptBias[j] = (std::min(stepX[j], 0) + std::min(stepY[j], 0)) * 3;
+        }
 
-                if (simd::any(tileMask)) [[unlikely]] {
-                    VaryingBuffer vars = {
-                        .Attribs = (float*)&tri.Vertices->Attribs + i,
-                        .TileOffset = fb.GetPixelOffset(x, y),
-                        .W1 = simd::conv2f(w1) * area,
-                        .W2 = simd::conv2f(w2) * area,
-                    };
-                    VFloat oldDepth = VFloat::load(&fb.DepthBuffer[vars.TileOffset]);
-                    VFloat newDepth = vars.GetSmooth(VaryingBuffer::AttribZ);
+        // Blocks are aligned to the coarse depth buffer, tiles outside the bounding box are masked out.
+        for (uint32_t y = minY & ~15u; y <= maxY; y += 16) {
+            uint32_t firstRow = y < minY ? (minY - y) / 4 : 0, lastRow = std::min(maxY - y, 12u) / 4;
+            VMask rowMask = (VMask)((2u << (lastRow * 4 + 3)) - (1u << (firstRow * 4)));
+
+            for (uint32_t x = minX & ~15u; x <= maxX; x += 16) {
+                uint32_t firstCol = x < minX ? (minX - x) / 4 : 0, lastCol = std::min(maxX - x, 12u) / 4;
+                VMask colMask = (VMask)(((2u << lastCol) - (1u << firstCol)) * 0x1111);
+
+                uint32_t coarseOffset = fb.GetCoarseDepthOffset(x, y);
+                VFloat coarseDepth = VFloat::load(&fb.CoarseDepthBuffer[coarseOffset]);
+                VMask liveMask = rowMask & colMask & CoarseDepthTest<State.DepthTest>(minDepth, coarseDepth);
+                VMask fullMask = 0xFFFF;
+                alignas(64) int32_t tileW[3][VInt::Length];
+
+                int32_t bx = (int32_t)x - (int32_t)minX, by = (int32_t)y - (int32_t)minY;
+
+                for (uint32_t j = 0; j < 3; j++) {
+                    // Partial products may not fit in 32 bits for large viewports, but the edge value does
+                    VInt w = blockW[j] + (int32_t)((int64_t)stepX[j] * bx + (int64_t)stepY[j] * by);
+                    liveMask &= (w + rejectBias[j]) >= 0;
+                    fullMask &= (w + acceptBias[j]) >= 0;
+                    w.store(tileW[j]);
+                }
 
-                    tileMask &= newDepth < oldDepth;
+                for (uint32_t t : BitIter(liveMask)) {
+                    VInt w1 = pixelW[1] + tileW[1][t];
+                    VInt w2 = pixelW[2] + tileW[2][t];
+                    VMask tileMask = 0xFFFF;
 
-                    if (simd::any(tileMask)) {
-                        vars.Depth = newDepth;
-                        vars.TileMask = tileMask;
+                    // Only partially covered tiles need per-pixel edge tests
+                    if (!(fullMask >> t & 1)) {
+                        VInt w0 = pixelW[0] + tileW[0][t];
+                        tileMask = (w0 | w1 | w2) >= 0;
 
-                        [[clang::always_inline]] shader.ShadePixels(fb, vars);
+                        if (!simd::any(tileMask)) continue;
                     }
+                    ShadeTile(shader, tri, i, x + t % 4 * 4, y + t / 4 * 4, tileMask, w1, w2, *bin.Queue);
                 }
-                w0 += stepX0, w1 += stepX1, w2 += stepX2;
             }
-            rowW0 += stepY0, rowW1 += stepY1, rowW2 += stepY2;
         }
     }
 
 public:
-    Rasterizer(std::shared_ptr<Framebuffer> fb);
+    // `batchCapacity` is the number of triangles each setup thread can queue before they are rasterized.
+    // Larger batches need fewer passes over the bins, but delay the start of rasterization.
+    Rasterizer(std::shared_ptr<Framebuffer> fb, uint32_t batchCapacity = TriangleBatch::DefaultCapacity);
 
+    // Records a draw call, to be executed by the next Flush(). Copies of `vertexData` and `shader` are kept
+    // for that, but the buffers and textures they point to must stay alive until then.
     template<ShaderProgram TShader>
-    void Draw(VertexReader& vertexData, const TShader& shader) {
+    void Submit(const VertexReader& vertexData, const TShader& shader) {
+        struct DrawState {
+            VertexReader Vertices;
+            TShader Shader;
+        };
+        uint32_t numTriangles = vertexData.Count / 3;
+        if (numTriangles == 0) return;
+
+        if (_draws.size() >= MaxDraws) Flush();
+
+        DrawState* state = _drawArena.New<DrawState>(vertexData, shader);
+
+        // Only cache vertices if they are shared by triangles, which is almost always the case for indexed meshes.
+        uint32_t numVertices = vertexData.VertexCount;
+        uint32_t numVertexPackets = numVertices != 0 && numVertices < numTriangles * 3 ? (numVertices + VInt::Length - 1) / VInt::Length : 0;
+
         ShaderInterface shifc = {
+            .State = state,
             .ReadVtxFn =
-                [&](size_t offset, ShadedVertexPacket vertices[3]) {
+                [](const void* p, size_t offset, ShadedVertexPacket vertices[3]) {
+                    const DrawState* state = (const DrawState*)p;
+                    // Called from multiple threads, so work on a copy of the reader
+                    VertexReader reader = state->Vertices;
                     VInt indices[3];
-                    vertexData.ReadTriangleIndices(offset, indices);
+                    reader.ReadTriangleIndices(offset, indices);
 
                     for (uint32_t vi = 0; vi < 3; vi++) {
-                        vertexData._Indices = indices[vi];
-                        shader.ShadeVertices(vertexData, vertices[vi]);
+                        reader._Indices = indices[vi];
+                        state->Shader.ShadeVertices(reader, vertices[vi]);
                     }
                     STAT_INCREMENT(VerticesShaded, VInt::Length * 3);
                 },
-            .DrawFn = [&](const BinnedTriangle& bt) { DrawBinnedTriangle(shader, bt); },
-            .NumCustomAttribs = shader.NumCustomAttribs,
+            .ShadeVtxFn =
+                [](const void* p, uint32_t firstVertex, ShadedVertexPacket& vertices) {
+                    const DrawState* state = (const DrawState*)p;
+                    VertexReader reader = state->Vertices;
+                    // Clamp the last packet to valid vertices, to avoid reading beyond the vertex buffer
+                    reader._Indices = simd::min(VInt::ramp() + (int32_t)firstVertex, (int32_t)reader.VertexCount - 1);
+                    state->Shader.ShadeVertices(reader, vertices);
+
+                    STAT_INCREMENT(VerticesShaded, VInt::Length);
+                },
+            .DrawFn =
+                [](Rasterizer& rast, const void* p, BinnedTriangle& bt, const TriangleBatch& batch, BinCursor& cursor) {
+                    rast.DrawBinnedRun(((const DrawState*)p)->Shader, bt, batch, cursor);
+                },
+            .FlushFn = nullptr,
+            .NumCustomAttribs = TShader::NumCustomAttribs,
+            .Cull = ShaderPipeline<TShader>.Cull,
         };
-        Draw(vertexData, shifc);
+        if constexpr (PacksFragments<TShader>) {
+            shifc.FlushFn = [](Rasterizer& rast, const void* p, FragmentQueue& queue) {
+                rast.FlushFragments(((const DrawState*)p)->Shader, queue);
+            };
+        }
+        _draws.push_back({
+            .Shader = shifc,
+            .Vertices = &state->Vertices,
+            .NumTriangles = numTriangles,
+            .NumVertexPackets = numVertexPackets,
+        });
+    }
+
+    // Called with the pixel bounds of a bin, see Flush().
+    using BinCallback = std::function<void(uint32_t x, uint32_t y, uint32_t width, uint32_t height)>;
+
+    // Sets up and rasterizes all submitted draws. Triangles are always drawn in submission order.
+    // If given, `onBinDone` is called for every bin of the framebuffer (including empty ones) on the same thread
+    // that rasterized it, right after its last triangle, so that post passes can run while the bin is still in cache.
+    // Bins split between threads are reported one quadrant at a time. It may only touch pixels within the given bounds.
+    // Pending framebuffer clears are resolved before that.
+    void Flush(const BinCallback& onBinDone = nullptr);
+
+    // Same as Submit() followed by Flush().
+    template<ShaderProgram TShader>
+    void Draw(const VertexReader& vertexData, const TShader& shader) {
+        Submit(vertexData, shader);
+        Flush();
     }
 };
 
@@ -1,11 +1,10 @@
 #pragma once
 
 #include <concepts>
-#include <functional>
 
 #include "SIMD.h"
 
-namespace swr {
+namespace swr::inline SWR_ISA_NS {
 
 namespace pixfmt {
 
@@ -53,13 +52,13 @@ struct RG16f {
 
     UnpackedTy Unpack() const {
         return {
-            _mm512_cvtph_ps(_mm512_cvtepi32_epi16(Packed)),
-            _mm512_cvtph_ps(_mm512_cvtepi32_epi16(Packed >> 16)),
+            simd::f16tof32(Packed),
+            simd::f16tof32(simd::shrl(Packed, 16)),
         };
     }
     static RG16f Pack(const UnpackedTy& value) {
-        VInt r = _mm512_cvtepi16_epi32(_mm512_cvtps_ph(value.x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
-        VInt g = _mm512_cvtepi16_epi32(_mm512_cvtps_ph(value.y, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+        VInt r = simd::f32tof16(value.x);
+        VInt g = simd::f32tof16(value.y);
         return { r | (g << 16) };
     }
 };
@@ -164,13 +163,14 @@ HdrTexture2D LoadImageHDR(std::string_view path, uint32_t mipLevels = 8);
 HdrTexture2D LoadCubemapFromPanoramaHDR(std::string_view path, uint32_t mipLevels = 8);
 
 // Iterates over the given rect in 4x4 tile steps. Visitor takes normalized UVs centered around pixel center.
-inline void IterateTiles(uint32_t width, uint32_t height, std::function<void(uint32_t, uint32_t, VFloat, VFloat)> visitor) {
+template<typename Visitor>
+inline void IterateTiles(uint32_t width, uint32_t height, const Visitor& visitor) {
     assert(width % 4 == 0 && height % 4 == 0);
 
     for (int32_t y = 0; y < height; y += 4) {
         for (int32_t x = 0; x < width; x += 4) {
-            VFloat u = simd::conv2f(x + FragPixelOffsetsX) + 0.5f;
-            VFloat v = simd::conv2f(y + FragPixelOffsetsY) + 0.5f;
+            VFloat u = simd::conv2f(x + FragPixelOffsetsX()) + 0.5f;
+            VFloat v = simd::conv2f(y + FragPixelOffsetsY()) + 0.5f;
             visitor((uint32_t)x, (uint32_t)y, u * (1.0f / width), v * (1.0f / height));
         }
     }
@@ -238,7 +238,7 @@ inline VFloat3 UnprojectCubemap(VFloat u, VFloat v, VInt faceIdx) {
 
 // Lookups the adjacent cube face and UVs to the nearest edge.
 inline void GetAdjacentCubeFace(VInt& faceIdx, VInt& u, VInt& v, VInt scaleU, VInt scaleV) {
-    static const uint8_t AdjFaceLUT[4][8] = {
+    alignas(64) static const int32_t AdjFaceLUT[4][8] = {
         { 0x1b, 0x0b, 0x25, 0x05, 0x23, 0x03 },  //
         { 0x0a, 0x1a, 0x04, 0x24, 0x02, 0x22 },  //
         { 0x15, 0x05, 0x29, 0x09, 0x11, 0x01 },  //
@@ -255,7 +255,7 @@ inline void GetAdjacentCubeFace(VInt& faceIdx, VInt& u, VInt& v, VInt scaleU, VI
     VInt quadIdx = simd::csel(simd::abs(cu) > simd::abs(cv), simd::shrl(cu, 31) + 2, simd::shrl(cv, 31));
     VInt tableIdx = quadIdx * 8 + faceIdx;
 
-    VInt data = _mm512_permutexvar_epi8(tableIdx, _mm512_broadcast_i32x8(_mm256_loadu_epi8(AdjFaceLUT)));
+    VInt data = simd::permute2(VInt::load(AdjFaceLUT[0]), VInt::load(AdjFaceLUT[2]), tableIdx);
 
     faceIdx = data & 7;
 
@@ -271,25 +271,18 @@ inline void GetAdjacentCubeFace(VInt& faceIdx, VInt& u, VInt& v, VInt scaleU, VI
 
 // Texture swizzling doesn't improve performance by much, the functions below are keept for reference.
 
-// 32-bit Z-curve/morton encode. Takes ~8.5 cycles per 16 coord pairs on TigerLake, according to llvm-mca.
+// 32-bit Z-curve/morton encode of the low 16 bits of each coord, by spreading bits with shift-and-mask.
+// - https://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
 // - https://lemire.me/blog/2018/01/09/how-fast-can-you-bit-interleave-32-bit-integers-simd-edition/
-// - https://github.com/KWillets/simd_interleave/blob/master/simd.c
 inline VInt Interleave(VInt x, VInt y) {
-    const __m512i m0 = _mm512_broadcast_i32x4(_mm_set_epi8(85, 84, 81, 80, 69, 68, 65, 64, 21, 20, 17, 16, 5, 4, 1, 0));
-    const __m512i m1 = _mm512_slli_epi64(m0, 1);
-    const __m512i bm = _mm512_set_epi8(125, 61, 124, 60, 121, 57, 120, 56, 117, 53, 116, 52, 113, 49, 112, 48, 109, 45, 108, 44, 105, 41,
-                                       104, 40, 101, 37, 100, 36, 97, 33, 96, 32, 93, 29, 92, 28, 89, 25, 88, 24, 85, 21, 84, 20, 81, 17,
-                                       80, 16, 77, 13, 76, 12, 73, 9, 72, 8, 69, 5, 68, 4, 65, 1, 64, 0);
-
-    __m512i xl = _mm512_shuffle_epi8(m0, (x >> 0) & 0x0F'0F'0F'0F);
-    __m512i xh = _mm512_shuffle_epi8(m0, (x >> 4) & 0x0F'0F'0F'0F);
-    __m512i yl = _mm512_shuffle_epi8(m1, (y >> 0) & 0x0F'0F'0F'0F);
-    __m512i yh = _mm512_shuffle_epi8(m1, (y >> 4) & 0x0F'0F'0F'0F);
-
-    __m512i lo = _mm512_or_si512(xl, yl);
-    __m512i hi = _mm512_or_si512(xh, yh);
-
-    return _mm512_permutex2var_epi8(lo, bm, hi);
+    const auto Spread = [](VInt v) {
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return Spread(x & 0xFFFF) | (Spread(y & 0xFFFF) << 1);
 }
 inline VInt GetTiledOffset(VInt ix, VInt iy, VInt rowShift) {
     VInt tileId = (ix >> 2) + ((iy >> 2) << (rowShift - 2));
@@ -350,7 +343,7 @@ struct Texture2D {
             assert(layerSize * (uint64_t)numLayers < UINT_MAX);
         }
 
-        Data = alloc_buffer<uint32_t>(layerSize * numLayers + 16);
+        Data = alloc_buffer<uint32_t>(layerSize * numLayers + 16, MemoryUsage::Texture);
 
         _scaleU = (float)width;
         _scaleV = (float)height;
@@ -381,11 +374,12 @@ struct Texture2D {
         uint32_t* dst = &Data[(layer << LayerShift) + (uint32_t)_mipOffsets[mipLevel]];
         uint32_t stride = RowShift - mipLevel;
 
-        __m512i packed = value.Packed;
-        _mm_storeu_epi32(&dst[x + ((y + 0) << stride)], _mm512_extracti32x4_epi32(packed, 0));
-        _mm_storeu_epi32(&dst[x + ((y + 1) << stride)], _mm512_extracti32x4_epi32(packed, 1));
-        _mm_storeu_epi32(&dst[x + ((y + 2) << stride)], _mm512_extracti32x4_epi32(packed, 2));
-        _mm_storeu_epi32(&dst[x + ((y + 3) << stride)], _mm512_extracti32x4_epi32(packed, 3));
+        alignas(64) uint32_t packed[16];
+        value.Packed.store(packed);
+
+        for (uint32_t ty = 0; ty < 4; ty++) {
+            std::memcpy(&dst[x + ((y + ty) << stride)], &packed[ty * 4], 16);
+        }
     }
 
     void GenerateMips() {
@@ -432,7 +426,7 @@ struct Texture2D {
             ix = ix >> mipLevel;
             iy = iy >> mipLevel;
             stride -= mipLevel;
-            offset += _mm512_permutexvar_epi32(mipLevel, _mipOffsets);
+            offset += simd::permute(_mipOffsets, mipLevel);
         }
 
         // Sample
@@ -450,8 +444,8 @@ struct Texture2D {
         if constexpr (IsCubeSample_) {
             //    x < 1 || x >= N
             // =  (x-1) >= (N-1)     given twos-complement + unsigned cmp
-            VMask edgeU = _mm512_cmpge_epu32_mask((ix >> LerpFracBits) - 1, (_maskU >> mipLevel) - 1);
-            VMask edgeV = _mm512_cmpge_epu32_mask((iy >> LerpFracBits) - 1, (_maskV >> mipLevel) - 1);
+            VMask edgeU = simd::uge((ix >> LerpFracBits) - 1, (_maskU >> mipLevel) - 1);
+            VMask edgeV = simd::uge((iy >> LerpFracBits) - 1, (_maskV >> mipLevel) - 1);
 
             if (simd::any(edgeU | edgeV)) [[unlikely]] {
                 return SampleLinearNearCubeEdge(ix, iy, offset, stride, mipLevel, layer);
@@ -599,8 +593,8 @@ private:
 
         for (uint32_t y = 0; y < h; y += 4) {
             for (uint32_t x = 0; x < w; x += 4) {
-                VInt ix = ((int32_t)x + FragPixelOffsetsX) << 1;
-                VInt iy = ((int32_t)y + FragPixelOffsetsY) << 1;
+                VInt ix = ((int32_t)x + FragPixelOffsetsX()) << 1;
+                VInt iy = ((int32_t)y + FragPixelOffsetsY()) << 1;
 
                 // This will never go out of bounds if texture size is POT and >4x4.
                 // Storage is padded by +16*4 bytes so nothing bad should happen if we do.
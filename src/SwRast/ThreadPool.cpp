@@ -0,0 +1,186 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <immintrin.h>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace swr {
+
+// Loops tend to come in quick succession (e.g. bins then post passes), so workers
+// spin for a while before going to sleep, avoiding the cost of a full wake-up.
+static const uint32_t SpinIterations = 4096;
+
+static thread_local bool t_InsideJob = false;
+static std::unique_ptr<ThreadPool> s_SharedPool;
+
+// Returns the indices of the cores this process is allowed to run on.
+static std::vector<uint32_t> GetAvailableCores() {
+    std::vector<uint32_t> cores;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (uint32_t i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &set)) cores.push_back(i);
+        }
+    }
+#endif
+    if (cores.empty()) {
+        uint32_t count = std::max(std::thread::hardware_concurrency(), 1u);
+        for (uint32_t i = 0; i < count; i++) cores.push_back(i);
+    }
+    return cores;
+}
+
+#ifdef _WIN32
+static void PinThread(HANDLE thread, uint32_t core) { SetThreadAffinityMask(thread, 1ull << (core % 64)); }
+static HANDLE GetCurrentThreadHandle() { return GetCurrentThread(); }
+#elif defined(__linux__)
+static void PinThread(pthread_t thread, uint32_t core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+static pthread_t GetCurrentThreadHandle() { return pthread_self(); }
+#else
+static void PinThread(std::thread::native_handle_type thread, uint32_t core) {}
+static std::thread::native_handle_type GetCurrentThreadHandle() { return {}; }
+#endif
+
+ThreadPool::ThreadPool(uint32_t numThreads, bool pinThreads) {
+    std::vector<uint32_t> cores = GetAvailableCores();
+
+    _numThreads = numThreads != 0 ? numThreads : (uint32_t)cores.size();
+    _ranges = std::make_unique<WorkRange[]>(_numThreads);
+
+    // Thread 0 is whoever calls ParallelFor(), normally the main thread.
+    if (pinThreads) {
+        for (uint32_t i = 0; i < _numThreads; i++) {
+            _pinnedCores.push_back(cores[i % cores.size()]);
+        }
+        PinThread(GetCurrentThreadHandle(), _pinnedCores[0]);
+    }
+    for (uint32_t i = 1; i < _numThreads; i++) {
+        std::thread& worker = _workers.emplace_back([this, i]() { WorkerLoop(i); });
+
+        if (pinThreads) {
+            PinThread(worker.native_handle(), _pinnedCores[i]);
+        }
+    }
+}
+ThreadPool::~ThreadPool() {
+    _shutdown.store(true);
+    _generation.fetch_add(1, std::memory_order_release);
+    _generation.notify_all();
+
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t)>& fn) {
+    if (chunkSize == 0) {
+        chunkSize = std::max(count / (_numThreads * 8), 1u);
+    }
+    if (t_InsideJob || _numThreads == 1 || count <= chunkSize) {
+        for (uint32_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+    std::lock_guard lock(_submitMutex);
+
+    for (uint32_t i = 0; i < _numThreads; i++) {
+        _ranges[i].Next.store(GetRangeStart(count, i), std::memory_order_relaxed);
+        _ranges[i].End = GetRangeStart(count, i + 1);
+    }
+    _job = &fn;
+    _chunkSize = chunkSize;
+    _numBusy.store(_numThreads - 1, std::memory_order_relaxed);
+
+    _generation.fetch_add(1, std::memory_order_release);
+    _generation.notify_all();
+
+    RunJob(0);
+
+    for (uint32_t spin = 0;; spin++) {
+        uint32_t busy = _numBusy.load(std::memory_order_acquire);
+        if (busy == 0) break;
+
+        if (spin < SpinIterations) {
+            _mm_pause();
+        } else {
+            _numBusy.wait(busy, std::memory_order_acquire);
+        }
+    }
+    _job = nullptr;
+}
+
+void ThreadPool::WorkerLoop(uint32_t threadIdx) {
+    uint32_t lastGen = 0;
+
+    while (true) {
+        for (uint32_t spin = 0;; spin++) {
+            uint32_t gen = _generation.load(std::memory_order_acquire);
+            if (gen != lastGen) {
+                lastGen = gen;
+                break;
+            }
+            if (spin < SpinIterations) {
+                _mm_pause();
+            } else {
+                _generation.wait(lastGen, std::memory_order_acquire);
+            }
+        }
+        if (_shutdown.load()) return;
+
+        RunJob(threadIdx);
+
+        if (_numBusy.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _numBusy.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunJob(uint32_t threadIdx) {
+    const std::function<void(uint32_t)>& fn = *_job;
+    uint32_t chunkSize = _chunkSize;
+
+    t_InsideJob = true;
+
+    // Start with our own range, then steal from the next ones.
+    for (uint32_t i = 0; i < _numThreads; i++) {
+        WorkRange& range = _ranges[(threadIdx + i) % _numThreads];
+
+        while (true) {
+            uint32_t start = range.Next.fetch_add(chunkSize, std::memory_order_relaxed);
+            if (start >= range.End) break;
+
+            uint32_t end = std::min(start + chunkSize, range.End);
+
+            for (uint32_t j = start; j < end; j++) {
+                fn(j);
+            }
+        }
+    }
+    t_InsideJob = false;
+}
+
+ThreadPool& ThreadPool::Shared() {
+    if (s_SharedPool == nullptr) {
+        s_SharedPool = std::make_unique<ThreadPool>();
+    }
+    return *s_SharedPool;
+}
+void ThreadPool::ConfigureShared(uint32_t numThreads, bool pinThreads) {
+    s_SharedPool.reset();
+    s_SharedPool = std::make_unique<ThreadPool>(numThreads, pinThreads);
+}
+
+};  // namespace swr
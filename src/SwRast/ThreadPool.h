@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace swr {
+
+// Persistent pool of worker threads for data-parallel loops.
+// Each loop is split into one contiguous range per thread, which are consumed in chunks.
+// Threads that run out of work steal chunks from the ranges of other threads.
+class ThreadPool {
+public:
+    // `numThreads` includes the thread calling ParallelFor(), 0 uses all available cores.
+    // `pinThreads` sets the affinity of each thread (including the caller) to a different core.
+    ThreadPool(uint32_t numThreads = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t GetNumThreads() const { return _numThreads; }
+    // Core each thread is pinned to, empty if threads are not pinned.
+    std::span<const uint32_t> GetPinnedCores() const { return _pinnedCores; }
+
+    // Calls `fn(i)` for every `i` in [0, count) and waits for all of them to complete.
+    // `chunkSize` is the number of indices a thread takes at once, 0 picks one based on `count`.
+    // Nested calls from within `fn` run serially on the calling thread.
+    void ParallelFor(uint32_t count, uint32_t chunkSize, const std::function<void(uint32_t)>& fn);
+    // First index of the range thread `threadIdx` starts with in ParallelFor(count, ...).
+    uint32_t GetRangeStart(uint32_t count, uint32_t threadIdx) const { return (uint32_t)((uint64_t)count * threadIdx / _numThreads); }
+
+    // Pool used by the renderer, created with default settings on first use.
+    static ThreadPool& Shared();
+    // Replaces the shared pool. Must not be called while a loop is running on it.
+    static void ConfigureShared(uint32_t numThreads, bool pinThreads);
+
+private:
+    struct alignas(64) WorkRange {
+        std::atomic<uint32_t> Next;
+        uint32_t End;
+    };
+
+    uint32_t _numThreads;
+    std::vector<std::thread> _workers;
+    std::vector<uint32_t> _pinnedCores;
+    std::unique_ptr<WorkRange[]> _ranges;
+
+    const std::function<void(uint32_t)>* _job = nullptr;
+    uint32_t _chunkSize = 1;
+
+    alignas(64) std::atomic<uint32_t> _generation = 0;  // Incremented for every job, workers wait for changes
+    alignas(64) std::atomic<uint32_t> _numBusy = 0;     // Workers still running the current job
+    std::atomic<bool> _shutdown = false;
+    std::mutex _submitMutex;
+
+    void WorkerLoop(uint32_t threadIdx);
+    void RunJob(uint32_t threadIdx);
+};
+
+};  // namespace swr